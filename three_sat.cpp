@@ -17,6 +17,29 @@
 #include <string.h>
 #include <math.h>
 
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#if defined(THREE_SAT_PROFILE) && defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+//build with -mavx2 (gcc, clang) or /arch:AVX2 (msvc) for the AVX2 clause energy kernel, unless THREE_SAT_NO_AVX2 is defined
+#if defined(__AVX2__) && !defined(THREE_SAT_NO_AVX2)
+#define THREE_SAT_AVX2 1
+#include <immintrin.h>
+#else
+#define THREE_SAT_AVX2 0
+#endif
+
 typedef int8_t	int8;
 typedef int16_t int16;
 typedef int32_t int32;
@@ -41,7 +64,7 @@ typedef size_t mem_index;
 global_variable bool32 _running;
 
 
-int assert(bool condition, char* error) {
+int assert(bool condition, const char* error) {
 	if (!condition) {
 		printf("assert:");
 		printf(error);
@@ -52,6 +75,354 @@ int assert(bool condition, char* error) {
 
 #define ASSERT(condition,error) if(!condition) {printf("assert: "); printf(error); exit(0);}
 
+/*
+ Timings and counters of the phases of a sweep. Phase times include the phases they call (optimize includes
+ prioritize, solve includes add_clause).
+ The PROFILE_ macros record into the Profile of the current thread (profile_current, set with PROFILE_SET), and
+ compile to nothing unless THREE_SAT_PROFILE is defined.
+*/
+enum ProfilePhase {
+	PHASE_GENERATE,
+	PHASE_OPTIMIZE,
+	PHASE_ORDER,
+	PHASE_PRIORITIZE,
+	PHASE_TRANSFORM,
+	PHASE_SOLVE,
+	PHASE_ADD_CLAUSE,
+	PHASE_TEST_SOLUTION,
+	PROFILE_PHASE_COUNT,
+};
+
+enum ProfileCounter {
+	COUNTER_OPTIMIZE_RESTARTS,
+	COUNTER_OPTIMIZE_ITERATIONS,
+	COUNTER_SWAPS,
+	//add_clause structural operations, and the tree bytes they move
+	COUNTER_TREE_SPLITS, //{A}: an x node expanded into 0 and 1 subtrees
+	COUNTER_TREE_SPLIT_BYTES,
+	COUNTER_ZERO_INSERTS, //{B}, {E}: a missing 0 subtree inserted before a 1 subtree
+	COUNTER_ZERO_INSERT_BYTES,
+	COUNTER_ONE_INSERTS, //{C}, {D}, {E}: a missing 1 sibling added after a 0 subtree
+	COUNTER_ONE_INSERT_BYTES,
+	COUNTER_WIND_BACKS, //searches back up the tree for the next branch to go down
+	COUNTER_WIND_BACK_STEPS, //nodes and branches walked by those searches
+	COUNTER_TREE_COLLAPSES, //identical 0 and 1 siblings merged into an x
+	COUNTER_TREE_COLLAPSE_BYTES,
+	COUNTER_ALLOCATIONS,
+	COUNTER_FREES,
+	PROFILE_COUNTER_COUNT,
+};
+
+//hardware counters, read around the phases of hardware_phases
+enum HardwareCounter {
+	HARDWARE_CYCLES,
+	HARDWARE_INSTRUCTIONS,
+	HARDWARE_CACHE_MISSES,
+	HARDWARE_BRANCH_MISSES,
+	HARDWARE_COUNTER_COUNT,
+};
+
+const char* profile_phase_names[PROFILE_PHASE_COUNT] = { "generate", "optimize", "order", "prioritize", "transform", "solve", "add_clause", "test_solution" };
+const char* profile_counter_names[PROFILE_COUNTER_COUNT] = { "optimize restarts", "optimize iterations", "swaps", "tree splits", "tree split bytes", "zero inserts", "zero insert bytes", "one inserts", "one insert bytes", "wind backs", "wind back steps", "tree collapses", "tree collapse bytes", "allocations", "frees" };
+
+struct Profile {
+	uint64 phase_nanoseconds[PROFILE_PHASE_COUNT];
+	uint64 phase_calls[PROFILE_PHASE_COUNT];
+	uint64 counters[PROFILE_COUNTER_COUNT];
+	uint64 hardware[PROFILE_PHASE_COUNT][HARDWARE_COUNTER_COUNT]; //zero when the counters are unavailable
+};
+
+void profile_init(Profile* profile) {
+	memset(profile, 0, sizeof(Profile));
+}
+
+void profile_merge(Profile* profile, Profile* other) {
+	for (uint32 p = 0; p < PROFILE_PHASE_COUNT; p++) {
+		profile->phase_nanoseconds[p] += other->phase_nanoseconds[p];
+		profile->phase_calls[p] += other->phase_calls[p];
+		for (uint32 h = 0; h < HARDWARE_COUNTER_COUNT; h++) {
+			profile->hardware[p][h] += other->hardware[p][h];
+		}
+	}
+	for (uint32 c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+		profile->counters[c] += other->counters[c];
+	}
+}
+
+void profile_print(Profile* profile) {
+	for (uint32 p = 0; p < PROFILE_PHASE_COUNT; p++) {
+		printf("profile %s: %llu calls, %lf s\n", profile_phase_names[p], (unsigned long long)profile->phase_calls[p], profile->phase_nanoseconds[p] * 1e-9);
+	}
+	for (uint32 p = 0; p < PROFILE_PHASE_COUNT; p++) {
+		uint64* hardware = profile->hardware[p];
+		if (hardware[HARDWARE_CYCLES] == 0 || hardware[HARDWARE_INSTRUCTIONS] == 0) continue;
+		real64 kilo_instructions = hardware[HARDWARE_INSTRUCTIONS] * 1e-3;
+		printf("profile %s hardware: %lf IPC, %lf cache misses and %lf branch misses per 1000 instructions (%llu cycles, %llu instructions)\n", profile_phase_names[p],
+			(real64)hardware[HARDWARE_INSTRUCTIONS] / (real64)hardware[HARDWARE_CYCLES], hardware[HARDWARE_CACHE_MISSES] / kilo_instructions, hardware[HARDWARE_BRANCH_MISSES] / kilo_instructions,
+			(unsigned long long)hardware[HARDWARE_CYCLES], (unsigned long long)hardware[HARDWARE_INSTRUCTIONS]);
+	}
+	for (uint32 c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+		printf("profile %s: %llu\n", profile_counter_names[c], (unsigned long long)profile->counters[c]);
+	}
+}
+
+#if defined(THREE_SAT_PROFILE)
+thread_local Profile* profile_current = NULL;
+
+/*
+ Trace of begin and end events (Chrome trace format, for chrome://tracing or Perfetto), between trace_start and
+ trace_stop. Every thread writes its events to a ring buffer of its own, without locks; when it is full the oldest
+ events are overwritten. The buffer of a thread that exits goes to the next new thread (the optimize restart
+ threads come and go), which continues its timeline. trace_stop writes the buffers to the file, and must be called
+ once the traced threads are idle.
+*/
+struct TraceEvent {
+	const char* name;
+	char type; //'B' or 'E'
+	uint64 nanoseconds; //since trace_start
+	const char* arg_name; //or NULL
+	uint64 arg;
+};
+
+struct TraceBuffer {
+	TraceEvent* events;
+	uint32 size;
+	uint32 thread;
+	std::atomic<uint64> head; //events written, only by the thread of the buffer
+	TraceBuffer* next; //in trace_buffers
+	TraceBuffer* next_free; //in trace_free_buffers
+};
+
+std::atomic<bool> trace_enabled(false);
+std::atomic<TraceBuffer*> trace_buffers(NULL);
+std::atomic<uint32> trace_thread_count(0);
+std::mutex trace_free_lock;
+TraceBuffer* trace_free_buffers = NULL; //of the threads that exited
+uint32 trace_generation = 0;
+uint32 trace_events_per_thread = 0;
+const char* trace_path = NULL;
+std::chrono::steady_clock::time_point trace_start_time;
+
+//hands the buffer of the thread over when it exits
+struct TraceThread {
+	TraceBuffer* buffer = NULL;
+	uint32 generation = 0; //trace of the buffer, which trace_stop frees
+	~TraceThread() {
+		if (buffer == NULL || generation != trace_generation || !trace_enabled.load(std::memory_order_acquire)) return;
+		std::lock_guard<std::mutex> guard(trace_free_lock);
+		buffer->next_free = trace_free_buffers;
+		trace_free_buffers = buffer;
+	}
+};
+thread_local TraceThread trace_thread;
+
+void trace_event(const char* name, char type, const char* arg_name, uint64 arg) {
+	if (!trace_enabled.load(std::memory_order_acquire)) return;
+	TraceBuffer* buffer = trace_thread.buffer;
+	if (buffer == NULL || trace_thread.generation != trace_generation) {
+		//first event of the thread in this trace: take the buffer of an exited thread, or add a new one to the list
+		{
+			std::lock_guard<std::mutex> guard(trace_free_lock);
+			buffer = trace_free_buffers;
+			if (buffer != NULL) trace_free_buffers = buffer->next_free;
+		}
+		if (buffer == NULL) {
+			buffer = (TraceBuffer*)malloc(sizeof(TraceBuffer));
+			buffer->events = (TraceEvent*)malloc(trace_events_per_thread * sizeof(TraceEvent));
+			buffer->size = trace_events_per_thread;
+			buffer->thread = trace_thread_count++;
+			buffer->head.store(0, std::memory_order_relaxed);
+			buffer->next = trace_buffers.load(std::memory_order_relaxed);
+			while (!trace_buffers.compare_exchange_weak(buffer->next, buffer, std::memory_order_release, std::memory_order_relaxed));
+		}
+		trace_thread.buffer = buffer;
+		trace_thread.generation = trace_generation;
+	}
+	uint64 head = buffer->head.load(std::memory_order_relaxed);
+	TraceEvent* event = &buffer->events[head % buffer->size];
+	event->name = name;
+	event->type = type;
+	event->nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - trace_start_time).count();
+	event->arg_name = arg_name;
+	event->arg = arg;
+	buffer->head.store(head + 1, std::memory_order_release);
+}
+
+/*
+ Starts recording events to path, keeping the last events_per_thread events of every thread.
+*/
+void trace_start(const char* path, uint32 events_per_thread) {
+	trace_path = path;
+	trace_events_per_thread = events_per_thread < 2 ? 2 : events_per_thread;
+	trace_generation++;
+	trace_thread_count = 0;
+	trace_start_time = std::chrono::steady_clock::now();
+	trace_enabled.store(true, std::memory_order_release);
+}
+
+void trace_stop() {
+	if (!trace_enabled.load(std::memory_order_acquire)) return;
+	trace_enabled.store(false, std::memory_order_release);
+	{
+		std::lock_guard<std::mutex> guard(trace_free_lock);
+		trace_free_buffers = NULL;
+	}
+	FILE* file = fopen(trace_path, "wb");
+	assert(file != NULL, "cannot open the trace file");
+	fprintf(file, "{\"traceEvents\":[\n");
+	bool first = true;
+	TraceBuffer* buffer = trace_buffers.exchange(NULL, std::memory_order_acquire);
+	while (buffer != NULL) {
+		uint64 head = buffer->head.load(std::memory_order_acquire);
+		uint64 begin = head > buffer->size ? head - buffer->size : 0;
+		for (uint64 i = begin; i < head; i++) {
+			TraceEvent* event = &buffer->events[i % buffer->size];
+			fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3lf,\"pid\":1,\"tid\":%u", first ? "" : ",\n", event->name, event->type, event->nanoseconds * 1e-3, buffer->thread);
+			if (event->arg_name != NULL) {
+				fprintf(file, ",\"args\":{\"%s\":%llu}", event->arg_name, (unsigned long long)event->arg);
+			}
+			fprintf(file, "}");
+			first = false;
+		}
+		TraceBuffer* next = buffer->next;
+		free(buffer->events);
+		free(buffer);
+		buffer = next;
+	}
+	fprintf(file, "\n]}\n");
+	fclose(file);
+}
+
+/*
+ Hardware counters of the current thread, through perf_event_open on Linux. The counters are one group, that the
+ kernel schedules as a whole, so their ratios hold even when it multiplexes them, and the counts of a scope are
+ scaled by the time the group was enabled over the time it ran, as perf does. Only user space is counted,
+ which perf_event_paranoid 2 allows. Where they cannot be opened (no PMU, a container, another OS),
+ hardware_read returns false and the phases go without.
+ The counters are opened once per thread, on its first read: the sweep and optimize threads live as long as their
+ pools, so they are not opened again for every instance.
+*/
+bool hardware_phases[PROFILE_PHASE_COUNT] = { false, true, false, false, false, true, false, true }; //optimize, solve, test_solution
+
+struct HardwareCounters {
+	bool opened = false;
+	int fds[HARDWARE_COUNTER_COUNT] = { -1, -1, -1, -1 };
+	~HardwareCounters() {
+#if defined(__linux__)
+		for (uint32 h = 0; h < HARDWARE_COUNTER_COUNT; h++) {
+			if (fds[h] >= 0) close(fds[h]);
+		}
+#endif
+	}
+};
+thread_local HardwareCounters hardware_counters;
+
+void hardware_open() {
+	hardware_counters.opened = true;
+#if defined(__linux__)
+	uint64 configs[HARDWARE_COUNTER_COUNT] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+	int* fds = hardware_counters.fds;
+	for (uint32 h = 0; h < HARDWARE_COUNTER_COUNT; h++) {
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[h];
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		fds[h] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, h == 0 ? -1 : fds[0], 0);
+		if (fds[h] < 0) {
+			for (uint32 g = 0; g < h; g++) {
+				close(fds[g]);
+				fds[g] = -1;
+			}
+			return;
+		}
+	}
+#endif
+}
+
+//values of the counters, and the nanoseconds their group was enabled and running
+struct HardwareSample {
+	uint64 values[HARDWARE_COUNTER_COUNT];
+	uint64 time_enabled;
+	uint64 time_running;
+};
+
+bool hardware_read(HardwareSample* sample) {
+	if (!hardware_counters.opened) hardware_open();
+	if (hardware_counters.fds[0] < 0) return false;
+#if defined(__linux__)
+	uint64 group[3 + HARDWARE_COUNTER_COUNT]; //count, time enabled, time running, then the values in the order of opening
+	if (read(hardware_counters.fds[0], group, sizeof(group)) != sizeof(group) || group[0] != HARDWARE_COUNTER_COUNT) return false;
+	sample->time_enabled = group[1];
+	sample->time_running = group[2];
+	memcpy(sample->values, &group[3], HARDWARE_COUNTER_COUNT * sizeof(uint64));
+	return true;
+#else
+	return false;
+#endif
+}
+
+//adds the hardware counts of its scope to the phase in profile_current
+struct HardwareScope {
+	ProfilePhase phase;
+	bool counting;
+	HardwareSample start;
+	HardwareScope(ProfilePhase p, bool active) : phase(p) {
+		counting = active && profile_current != NULL && hardware_read(&start);
+	}
+	~HardwareScope() {
+		HardwareSample end;
+		if (!counting || profile_current == NULL || !hardware_read(&end)) return;
+		//the group did not run during the scope: nothing to scale
+		uint64 running = end.time_running - start.time_running;
+		if (running == 0) return;
+		real64 scale = (real64)(end.time_enabled - start.time_enabled) / (real64)running;
+		for (uint32 h = 0; h < HARDWARE_COUNTER_COUNT; h++) {
+			profile_current->hardware[phase][h] += (uint64)((real64)(end.values[h] - start.values[h]) * scale + 0.5);
+		}
+	}
+};
+
+/*
+ Times a phase into profile_current, and traces its begin and end. The length of a tree (tree_length) is traced
+ with both events.
+*/
+struct ProfileScope {
+	ProfilePhase phase;
+	std::chrono::steady_clock::time_point start;
+	mem_index* tree_length;
+	HardwareScope hardware;
+	ProfileScope(ProfilePhase p, mem_index* length) : phase(p), start(std::chrono::steady_clock::now()), tree_length(length), hardware(p, hardware_phases[p]) {
+		trace_event(profile_phase_names[phase], 'B', tree_length != NULL ? "tree_length" : NULL, tree_length != NULL ? *tree_length : 0);
+	}
+	~ProfileScope() {
+		trace_event(profile_phase_names[phase], 'E', tree_length != NULL ? "tree_length" : NULL, tree_length != NULL ? *tree_length : 0);
+		if (profile_current == NULL) return;
+		profile_current->phase_nanoseconds[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		profile_current->phase_calls[phase]++;
+	}
+};
+
+#define PROFILE_SET(PROFILE) (profile_current = (PROFILE))
+#define PROFILE_SCOPE(PHASE) ProfileScope profile_scope(PHASE, NULL)
+#define PROFILE_SCOPE_TREE(PHASE, TREE) ProfileScope profile_scope(PHASE, &(TREE)->length)
+#define PROFILE_COUNT(COUNTER, N) do { if (profile_current != NULL) profile_current->counters[COUNTER] += (N); } while (0)
+#define PROFILE_HARDWARE(PHASE, ACTIVE) HardwareScope profile_hardware(PHASE, ACTIVE)
+#define TRACE_BEGIN(NAME, ARG_NAME, ARG) trace_event(NAME, 'B', ARG_NAME, ARG)
+#define TRACE_END(NAME) trace_event(NAME, 'E', NULL, 0)
+#else
+#define PROFILE_SET(PROFILE)
+#define PROFILE_SCOPE(PHASE)
+#define PROFILE_SCOPE_TREE(PHASE, TREE)
+#define PROFILE_COUNT(COUNTER, N)
+#define PROFILE_HARDWARE(PHASE, ACTIVE)
+#define TRACE_BEGIN(NAME, ARG_NAME, ARG)
+#define TRACE_END(NAME)
+#endif
+
 struct Buffer {
 	mem_index length = 0;
 	mem_index SIZE = 0;
@@ -275,12 +646,17 @@ void allocator_print(Allocator* alloc, int element_count) {
 void allocator_free(Allocator* alloc) {
 	if (alloc->address != 0) {
 		free(alloc->address);
+		free(alloc->segment_mem_index);
+		free(alloc->segment_ref_index);
+		free(alloc->segment_size);
+		alloc->address = 0;
 	}
 }
 
 int allocator_segment_create(Allocator* alloc, mem_index size) {
 
 	//print_allocator(alloc, 10);
+	PROFILE_COUNT(COUNTER_ALLOCATIONS, 1);
 
 	mem_index total_size_to_allocate = size + alloc->SEGMENT_HEADER_SIZE;
 	if (alloc->free_segment_index == alloc->SEGMENT_COUNT) {
@@ -367,6 +743,7 @@ int allocator_segment_create(Allocator* alloc, mem_index size) {
 
 void allocator_segment_free(Allocator* alloc, mem_index data_index) { 
 	//print_allocator(alloc, 10);
+	PROFILE_COUNT(COUNTER_FREES, 1);
 	mem_index header_index = data_index - alloc->SEGMENT_HEADER_SIZE;
 	assert(header_index >= 0, "header index should not be negative");
 	uint32 index = memory_read_integer(alloc->address, header_index, alloc->SEGMENT_HEADER_SIZE);
@@ -464,6 +841,17 @@ void list_resize(List* list) {
 	list->index = new_mem_index;
 }
 
+/*
+ Size of the largest segment that adding count elements to the list will create (0 if it does not grow). The old
+ segment of a list is only freed after the new one is created.
+*/
+mem_index list_grow_size(List* list, uint32 count) {
+	uint32 size = list->size;
+	while (list->length + count > size) size *= 2;
+	if (size == list->size) return 0;
+	return size * list->element_size + list->alloc->SEGMENT_HEADER_SIZE;
+}
+
 void list_add(List* list, void* element) {
 	int new_element_index = list->length;
 	assert(!list->fixed, "cannot add to a fixed list");
@@ -1068,6 +1456,7 @@ mem_index end_index_of_subtree(Buffer* tree, mem_index s_index) {
  Add a clause to a clause tree. This procedure avoids recursion.
 */
 void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc) {
+	PROFILE_SCOPE_TREE(PHASE_ADD_CLAUSE, tree);
 
 	if (tree->length == 0) {
 		buffer_clone(tree, clause_str);
@@ -1100,6 +1489,7 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 
 				if (c_index + 1 == n) { //we potentially have to wind back (we could be done going down a 0 subtree, and there may be a 1 subtree to get to).
 					//we've reach an end of branch
+					PROFILE_COUNT(COUNTER_WIND_BACKS, 1);
 					//check whether we should wind back c_index and move t_index forward to go down a sibling branch
 
 					mem_index c_i = c_index - 1;
@@ -1109,11 +1499,13 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 					while (true) {
 						if (buffer_read_byte(tree, t_i) == C_s) {
 							t_i--;
+							PROFILE_COUNT(COUNTER_WIND_BACK_STEPS, 1);
 						}
 						else {
 							mem_index current_length = segment_length(tree, t_i);
 							if (current_length < length) {
 								t_i--;
+								PROFILE_COUNT(COUNTER_WIND_BACK_STEPS, 1);
 							}
 							else if (current_length == length) {
 								//we're done, we found the right node
@@ -1155,6 +1547,7 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 										else {
 											//we're still going through subtrees, we keep looking ahead for a sibling branch
 											tmp_index = next_branch_index;
+											PROFILE_COUNT(COUNTER_WIND_BACK_STEPS, 1);
 										}
 									}
 									else {
@@ -1175,11 +1568,13 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 								while (true) {
 									if (C_s == buffer_read_byte(tree, t_i)) {
 										t_i--;
+										PROFILE_COUNT(COUNTER_WIND_BACK_STEPS, 1);
 									}
 									else {
 										mem_index current_length = segment_length(tree, t_i);
 										if (current_length < length) {
 											t_i--;
+											PROFILE_COUNT(COUNTER_WIND_BACK_STEPS, 1);
 										}
 										else if (current_length == length) {
 											//we're done, we found the right node
@@ -1234,6 +1629,8 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 				//.....0[subtree]|1[subtree]|[restOfTree]
 
 				mem_index subtree_length = length_of_subtree(tree, t_index + 1);
+				PROFILE_COUNT(COUNTER_TREE_SPLITS, 1);
+				PROFILE_COUNT(COUNTER_TREE_SPLIT_BYTES, tree->length - t_index);
 
 				//find end of current subtree.
 				buffer_shift_right(tree, t_index, subtree_length + 2);
@@ -1282,6 +1679,8 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 
 					//find end of current subtree.
 					mem_index c_str_length = n - c_index - 1;
+					PROFILE_COUNT(COUNTER_ZERO_INSERTS, 1);
+					PROFILE_COUNT(COUNTER_ZERO_INSERT_BYTES, tree->length - t_index);
 					buffer_shift_right(tree, t_index, c_str_length + 2);
 					buffer_write_byte(tree, C_0, t_index);
 					buffer_write_bytes(tree, t_index + 1, clause_str, c_index + 1, c_str_length);
@@ -1311,6 +1710,8 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 						mem_index subtree_length = length_of_subtree(tree, t_index + 1);
 						//no '0' below because we don't extract '0subtree'
 						mem_index c_str_length = n - c_index - 1;
+						PROFILE_COUNT(COUNTER_ONE_INSERTS, 1);
+						PROFILE_COUNT(COUNTER_ONE_INSERT_BYTES, tree->length - (t_index + subtree_length + 1));
 						buffer_shift_right(tree, t_index + subtree_length + 1, c_str_length + 2);
 						buffer_write_byte(tree, C_s, t_index + subtree_length + 1);
 						buffer_write_byte(tree, C_1, t_index + subtree_length + 2);
@@ -1328,6 +1729,7 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 
 				if (c_index + 1 == n) { //we potentially have to wind back (we could be done going down a 0 subtree, and there may be a 1 subtree to get to).
 					//we've reach an end of branch
+					PROFILE_COUNT(COUNTER_WIND_BACKS, 1);
 					//check whether we should wind back c_index and move t_index forward to go down a sibling branch
 
 					mem_index c_i = c_index - 1;
@@ -1337,11 +1739,13 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 					while (true) {
 						if (buffer_read_byte(tree,t_i) == C_s) {
 							t_i--;
+							PROFILE_COUNT(COUNTER_WIND_BACK_STEPS, 1);
 						}
 						else {
 							mem_index current_length = segment_length(tree, t_i);
 							if (current_length < length) {
 								t_i--;
+								PROFILE_COUNT(COUNTER_WIND_BACK_STEPS, 1);
 							}
 							else if (current_length == length) {
 								//we're done, we found the right node
@@ -1383,6 +1787,7 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 										else {
 											//we're still going through subtrees, we keep looking ahead for a sibling branch
 											tmp_index = next_branch_index;
+											PROFILE_COUNT(COUNTER_WIND_BACK_STEPS, 1);
 										}
 									}
 									else {
@@ -1402,11 +1807,13 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 								while (true) {
 									if (buffer_read_byte(tree, t_i) == C_s) {
 										t_i--;
+										PROFILE_COUNT(COUNTER_WIND_BACK_STEPS, 1);
 									}
 									else {
 										mem_index current_length = segment_length(tree, t_i);
 										if (current_length < length) {
 											t_i--;
+											PROFILE_COUNT(COUNTER_WIND_BACK_STEPS, 1);
 										}
 										else if (current_length == length) {
 											//we're done, we found the right node
@@ -1472,6 +1879,7 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 
 					if (c_index + 1 == n) { //we potentially have to wind back (we could be done going down a 0 subtree, and there may be a 1 subtree to get to).
 						//we've reach an end of branch
+						PROFILE_COUNT(COUNTER_WIND_BACKS, 1);
 						//check whether we should wind back c_index and move t_index forward to go down a sibling branch
 						mem_index c_i = c_index - 1;
 						mem_index length = n - c_i;
@@ -1479,11 +1887,13 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 						while (true) {
 							if (buffer_read_byte(tree, t_i) == C_s) {
 								t_i--;
+								PROFILE_COUNT(COUNTER_WIND_BACK_STEPS, 1);
 							}
 							else {
 								mem_index current_length = segment_length(tree, t_i);
 								if (current_length < length) {
 									t_i--;
+									PROFILE_COUNT(COUNTER_WIND_BACK_STEPS, 1);
 								}
 								else if (current_length == length) {
 									//we're done, we found the right node
@@ -1525,6 +1935,7 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 											else {
 												//we're still going through subtrees, we keep looking ahead for a sibling branch
 												tmp_index = next_branch_index;
+												PROFILE_COUNT(COUNTER_WIND_BACK_STEPS, 1);
 											}
 										}
 										else {
@@ -1544,11 +1955,13 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 									while (true) {
 										if (buffer_read_byte(tree, t_i) == C_s) {
 											t_i--;
+											PROFILE_COUNT(COUNTER_WIND_BACK_STEPS, 1);
 										}
 										else {
 											mem_index current_length = segment_length(tree, t_i);
 											if (current_length < length) {
 												t_i--;
+												PROFILE_COUNT(COUNTER_WIND_BACK_STEPS, 1);
 											}
 											else if (current_length == length) {
 												//we're done, we found the right node
@@ -1607,6 +2020,8 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 										//like {C} above
 										list_add(&checkpoints, &current_t_index);
 										mem_index c_str_length = n - c_index;
+										PROFILE_COUNT(COUNTER_ONE_INSERTS, 1);
+										PROFILE_COUNT(COUNTER_ONE_INSERT_BYTES, tree->length - (next_branch_index - 1));
 										buffer_shift_right(tree, next_branch_index - 1, c_str_length + 1);
 										buffer_write_byte(tree, C_s, next_branch_index - 1);
 										buffer_write_bytes(tree, next_branch_index, clause_str, c_index, c_str_length);
@@ -1614,6 +2029,7 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 										t_index = next_branch_index + n - c_index + 1;
 									}
 									//wind back 
+									PROFILE_COUNT(COUNTER_WIND_BACKS, 1);
 									while (true) {
 										mem_index length = segment_length(tree, t_index);
 										c_index = n - length;
@@ -1630,6 +2046,7 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 											mem_index tlength = tree->length;
 											if (tlength > t_index + length) { //there's a next branch
 												t_index = t_index + length + 1;
+												PROFILE_COUNT(COUNTER_WIND_BACK_STEPS, 1);
 											}
 											else {
 												done = true;
@@ -1652,6 +2069,8 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 								if (C_1 == t) { //t = 1, c = 0
 									list_add(&checkpoints, &current_t_index);
 									mem_index c_str_length = n - c_index;
+									PROFILE_COUNT(COUNTER_ZERO_INSERTS, 1);
+									PROFILE_COUNT(COUNTER_ZERO_INSERT_BYTES, tree->length - t_index);
 									buffer_shift_right(tree, t_index, c_str_length + 1);
 									buffer_write_bytes(tree, t_index, clause_str, c_index, c_str_length);
 									buffer_write_byte(tree, C_s, t_index + c_str_length);
@@ -1659,6 +2078,7 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 								else { //t = 0, c = 1
 									list_add(&checkpoints, &current_t_index);
 									//this just appends
+									PROFILE_COUNT(COUNTER_ONE_INSERTS, 1);
 									buffer_append_byte(tree, C_s);
 									buffer_append_bytes(tree, clause_str, c_index, n - c_index);
 								}
@@ -1677,6 +2097,8 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 					list_add(&checkpoints, &t_index);
 
 					mem_index c_str_length = n - c_index;
+					PROFILE_COUNT(COUNTER_ZERO_INSERTS, 1);
+					PROFILE_COUNT(COUNTER_ZERO_INSERT_BYTES, tree->length - t_index);
 					buffer_shift_right(tree, t_index, c_str_length + 1);
 					buffer_write_bytes(tree, t_index, clause_str, c_index, c_str_length);
 					buffer_write_byte(tree, C_s, t_index + c_str_length);
@@ -1686,6 +2108,7 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 					mem_index t_length = tree->length;
 					t_index = t_index + 2 * (n - c_index) + 2;
 					if (t_index < total_length) {
+						PROFILE_COUNT(COUNTER_WIND_BACKS, 1);
 						while (true) {
 							mem_index length = segment_length(tree, t_index);
 							c_index = n - length;
@@ -1702,6 +2125,7 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 								mem_index t_length = tree->length;
 								if (t_length > t_index + length) { //there's a next branch
 									t_index = t_index + length + 1;
+									PROFILE_COUNT(COUNTER_WIND_BACK_STEPS, 1);
 								}
 								else {
 									done = true;
@@ -1796,6 +2220,8 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 					//<-start>.<-t_tree--><--rest->
 					//========x===========|========
 
+					PROFILE_COUNT(COUNTER_TREE_COLLAPSES, 1);
+					PROFILE_COUNT(COUNTER_TREE_COLLAPSE_BYTES, tree->length - (s_end + 1));
 					buffer_shift_left(tree, s_end + 1, t_length + 2);
 					buffer_write_byte(tree, C_x, t_start);
 				}
@@ -1814,6 +2240,8 @@ void add_clause(Buffer* tree, Buffer* clause_str, mem_index n, Allocator* alloc)
 				//==========0|=======
 				//==========x|=======
 				if (t_start > 0) {
+					PROFILE_COUNT(COUNTER_TREE_COLLAPSES, 1);
+					PROFILE_COUNT(COUNTER_TREE_COLLAPSE_BYTES, tree->length - (s_end + 1));
 					buffer_shift_left(tree, s_end + 1, 2);
 					buffer_write_byte(tree, C_x, t_start);
 				}
@@ -1879,6 +2307,17 @@ real64 rand_next_real64(Rand* rand) {
 	return (((int64)rand_next(rand, 26) << 27) + rand_next(rand, 27)) / (real64)(1LL << 53);
 }
 
+/*
+ Derives the seed of an independent random stream from a base seed (splitmix64 mixing).
+ Used so that the numbers drawn for a given restart or task do not depend on the order in which they run.
+*/
+int64 rand_derive_seed(int64 seed, uint64 stream) {
+	uint64 z = (uint64)seed + (stream + 1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return (int64)(z ^ (z >> 31));
+}
+
 //generate a uniform int between [0,max-1]
 uint32 generate_int(int max, Rand* r) {
 	real64 p = rand_next_real64(r);
@@ -1914,14 +2353,16 @@ void test_rand() {
  generate a random 3-SAT instance, 
  n = number of vars, m = number of clauses, seed = random seed
 */
-void generate_random_instance(List* instance, uint32 n, uint32 m, Rand* r, Allocator* alloc) {
+/*
+ Adds distinct random clauses to an instance until it has m clauses.
+*/
+void extend_random_instance(List* instance, uint32 n, uint32 m, Rand* r) {
+	PROFILE_SCOPE(PHASE_GENERATE);
 
 	uint32 triplet_count = (n*(n - 1)*(n - 2)) / 6;
 	uint32 total_possible_clauses = 8 * triplet_count;
 	if (m > total_possible_clauses) m = total_possible_clauses;
 
-	list_clear(instance);
-
 	while (instance->length < m) {
 
 		uint32 i0 = 0, i1 = 0, i2 = 0;
@@ -1990,6 +2431,11 @@ void generate_random_instance(List* instance, uint32 n, uint32 m, Rand* r, Alloc
 	}
 }
 
+void generate_random_instance(List* instance, uint32 n, uint32 m, Rand* r, Allocator* alloc) {
+	list_clear(instance);
+	extend_random_instance(instance, n, m, r);
+}
+
 /*
  Finds one possible solution from the provided clause tree.
  Returns false if there are no solution (the clause tree is 'xxx...xx').
@@ -2167,6 +2613,7 @@ bool is_full_tree(Buffer* tree, uint32 n) {
 }
 
 bool solve_tree_instance_with_tree_size(List* instance, uint32 n, List* tree_sizes, Buffer* tree, List* solution, Allocator* alloc) {
+	PROFILE_SCOPE(PHASE_SOLVE);
 
 	Buffer exclusion_string;
 	buffer_init(&exclusion_string, n);
@@ -2205,63 +2652,123 @@ void check_clauses(List* clauses, List* varPos) {
 
 #define MAX_UINT32 ~((uint32)0)
 
-bool list_same(List* s1, List* s2) {
-	//look for equality at a shift (ring like)
-	assert(s1->length == s2->length, "list_same non matching length");
-	uint32 shift = 0;
-	uint32 n = s1->length;
-	uint32 v = list_read(s2, 0, uint32);
-	for (uint32 i = 0; i < n; i++) {
-		uint32 v1 = list_read(s1, i, uint32);
-		if (v1 == v) {
-			shift = i;
-			break;
-		}
-	}
-	for (uint32 i = 0; i < n; i++) {
-		uint32 shifted_index = (i + shift + n) % n;
-		uint32 v1 = list_read(s1, shifted_index, uint32);
-		uint32 v2 = list_read(s2, i, uint32);
-		if (v1 != v2) {
-			return false;
-		}
+/*
+ Open addressing set of 64 bit hashes. 0 is used to mark empty slots, so a 0 hash is stored as 1.
+ Clearing the set keeps its table, so a set that is reused does not allocate.
+*/
+struct HashSet {
+	List table;
+	uint32 count;
+};
+
+void hash_set_init(HashSet* set, Allocator* alloc, uint32 size) {
+	uint32 table_size = 16;
+	while (table_size < 2 * size) {
+		table_size <<= 1;
 	}
-	return true;
+	list_init(&set->table, alloc, sizeof(uint64), table_size, true);
+	list_set_to_zero(&set->table);
+	set->count = 0;
+}
+
+void hash_set_free(HashSet* set) {
+	list_free(&set->table);
+	set->count = 0;
+}
+
+void hash_set_clear(HashSet* set) {
+	list_set_to_zero(&set->table);
+	set->count = 0;
 }
 
-bool d_list_contains_list(List* states, List* state) {
-	for (uint32 i = 0; i < states->length; i++) {
-		List* s = d_list_read(states, i);
-		if (list_same(s, state)) {
+bool hash_set_contains(HashSet* set, uint64 key) {
+	if (key == 0) key = 1;
+	uint32 table_mask = set->table.length - 1;
+	uint32 slot = (uint32)(key ^ (key >> 32)) & table_mask;
+	while (true) {
+		uint64 k = list_read(&set->table, slot, uint64);
+		if (k == key) {
 			return true;
 		}
+		if (k == 0) {
+			return false;
+		}
+		slot = (slot + 1) & table_mask;
 	}
-	return false;
 }
 
-uint32 get_next_var(uint32 pos, int32 dir, List* var_ring) {
-
-	uint32 next_position = 0;
-	if (dir > 0) {
-		//move right
-		next_position = pos + 1;
-		if (next_position == var_ring->length) {
-			next_position = 0;
+//returns false if the key was already in the set
+bool hash_set_add(HashSet* set, uint64 key) {
+	if (key == 0) key = 1;
+	if (2 * (set->count + 1) > set->table.length) {
+		//grow the table and rehash
+		List old_table = set->table;
+		list_init(&set->table, old_table.alloc, sizeof(uint64), 2 * old_table.length, true);
+		list_set_to_zero(&set->table);
+		set->count = 0;
+		for (uint32 i = 0; i < old_table.length; i++) {
+			uint64 k = list_read(&old_table, i, uint64);
+			if (k != 0) {
+				hash_set_add(set, k);
+			}
 		}
+		list_free(&old_table);
 	}
-	else if (dir < 0) {
-		//move left
-		//check edge
-		next_position = pos - 1;
-		if (next_position == -1) {
-			next_position += var_ring->length;
+	uint32 table_mask = set->table.length - 1;
+	uint32 slot = (uint32)(key ^ (key >> 32)) & table_mask;
+	while (true) {
+		uint64 k = list_read(&set->table, slot, uint64);
+		if (k == key) {
+			return false;
 		}
+		if (k == 0) {
+			list_set(&set->table, slot, &key);
+			set->count++;
+			return true;
+		}
+		slot = (slot + 1) & table_mask;
 	}
-	else if (dir == 0) {
-		next_position = pos;
-	}
-	uint32 var = list_read(var_ring, next_position, uint32);
-	return var;
+}
+
+/*
+ Random key of the ordered pair of variables (a, b), for var b right after var a on the ring (splitmix64 of the pair).
+ The seed is fixed so that a given ring always hashes to the same value.
+*/
+uint64 ring_pair_key(uint32 a, uint32 b) {
+	return (uint64)rand_derive_seed(0x2545F4914F6CDD1DLL, ((uint64)a << 32) | b);
+}
+
+/*
+ Hash of the ring as the xor of the keys of all its (var, next var) pairs.
+ A ring and all its rotations have the same pairs, so the hash is rotation invariant.
+*/
+uint64 ring_hash(List* var_ring, uint32 n) {
+	uint64 hash = 0;
+	for (uint32 p = 0; p < n; p++) {
+		uint32 a = list_read(var_ring, p, uint32);
+		uint32 b = list_read(var_ring, (p + 1) % n, uint32);
+		hash ^= ring_pair_key(a, b);
+	}
+	return hash;
+}
+
+/*
+ Updates the ring hash for the swap of the vars at positions left_pos and left_pos + 1 (on the ring), in O(1).
+ Must be called before var_ring is updated. Only the three pairs around the swapped vars change:
+ ...a[l r]b... -> ...a[r l]b...
+*/
+uint64 ring_hash_swap(uint64 hash, List* var_ring, uint32 n, uint32 left_pos) {
+	uint32 a = list_read(var_ring, (left_pos + n - 1) % n, uint32);
+	uint32 l = list_read(var_ring, left_pos, uint32);
+	uint32 r = list_read(var_ring, (left_pos + 1) % n, uint32);
+	uint32 b = list_read(var_ring, (left_pos + 2) % n, uint32);
+	hash ^= ring_pair_key(a, l);
+	hash ^= ring_pair_key(l, r);
+	hash ^= ring_pair_key(r, b);
+	hash ^= ring_pair_key(a, r);
+	hash ^= ring_pair_key(r, l);
+	hash ^= ring_pair_key(l, b);
+	return hash;
 }
 
 void copy_clauses(List* clauses, List* out_clauses) {
@@ -2307,362 +2814,6 @@ void instance_print(List* instance, List* var_pos, List* var_ring, uint32 n) {
 }
 
 
-uint32 optimize(List* instance, uint32 n, List* in_var_pos, List* lowest_var_pos, List* lowest_var_ring, List* lowest_triplets, Rand* rand, Allocator* alloc) {
-
-	//this one assumes all clauses are 3 and treats them as a triangle, so we optimize
-	// only on the longest segment
-
-	uint32 pos_count = n;
-
-	//var_ring[x] is the index of the var at position x, or -1 if it's an empty slot
-	List var_ring;
-	list_init(&var_ring, alloc, sizeof(uint32), n, true);
-
-	//var_pos[v] is the position of variable v
-	List var_pos;
-	list_init(&var_pos, alloc, sizeof(uint32), n, true);
-
-	for (uint32 i = 0; i < n; i++) {
-		uint32 pos = list_read(in_var_pos, i, uint32);
-		list_set(&var_pos, i, &pos);
-	}
-
-	//list_print_uint32(&var_pos);
-
-	for (uint32 x = 0; x < pos_count; x++) {
-		for (uint32 v = 0; v < n; v++) {
-			uint32 pos = list_read(&var_pos, v, uint32);
-			if (pos == x) {
-				list_set(&var_ring, x, &v);
-				break;
-			}
-		}
-	}
-
-	//list_print_uint32(&var_ring);
-
-	List clauses;
-	uint32 m = instance->length;
-	list_init(&clauses, alloc, sizeof(Clause), m, false);
-	//transform clauses into 0 based unsigned lists
-	for (uint32 i = 0; i < m; i++) {
-		Clause clause = list_read(instance, i, Clause);
-		Clause triplet;
-		// 0 is always the leftmost element in varPos, 2 is the rightmost, and 1 is the middle one
-		uint32 v0 = clause.i0;
-		uint32 v1 = clause.i1;
-		uint32 v2 = clause.i2;
-		bool b0 = clause.b0;
-		bool b1 = clause.b1;
-		bool b2 = clause.b2;
-
-		uint32 pos0 = list_read(&var_pos, v0, uint32);
-		uint32 pos1 = list_read(&var_pos, v1, uint32);
-		uint32 pos2 = list_read(&var_pos, v2, uint32);
-		if (pos0 < pos1) { // 0 < 1
-			if (pos1 < pos2) {  // 0 < 1, 1 < 2
-				// 0 < 1 < 2
-				triplet.i0 = v0;
-				triplet.i1 = v1;
-				triplet.i2 = v2;
-				triplet.b0 = b0;
-				triplet.b1 = b1;
-				triplet.b2 = b2;
-			}
-			else if (pos0 < pos2) { // 0 < 1, 2 < 1, 0 < 2
-			 //0 < 2 < 1
-				triplet.i0 = v0;
-				triplet.i1 = v2;
-				triplet.i2 = v1;
-				triplet.b0 = b0;
-				triplet.b1 = b2;
-				triplet.b2 = b1;
-			}
-			else { // 0 < 1, 2 < 1, 2 < 0
-			 //2 < 0 < 1
-				triplet.i0 = v2;
-				triplet.i1 = v0;
-				triplet.i2 = v1;
-				triplet.b0 = b2;
-				triplet.b1 = b0;
-				triplet.b2 = b1;
-			}
-		}
-		else { // 1 < 0
-			if (pos0 < pos2) { // 1 < 0, 0 < 2
-				// 1 < 0 < 2
-				triplet.i0 = v1;
-				triplet.i1 = v0;
-				triplet.i2 = v2;
-				triplet.b0 = b1;
-				triplet.b1 = b0;
-				triplet.b2 = b2;
-			}
-			else if (pos1 < pos2) { //1 < 0, 2 < 0, 1 < 2
-			 // 1 < 2 < 0
-				triplet.i0 = v1;
-				triplet.i1 = v2;
-				triplet.i2 = v0;
-				triplet.b0 = b1;
-				triplet.b1 = b2;
-				triplet.b2 = b0;
-			}
-			else { // 1 < 0, 2 < 0, 2 < 1
-			 // 2 < 1 < 0
-				triplet.i0 = v2;
-				triplet.i1 = v1;
-				triplet.i2 = v0;
-				triplet.b0 = b2;
-				triplet.b1 = b1;
-				triplet.b2 = b0;
-			}
-		}
-		list_add(&clauses, &triplet);
-	}
-
-	check_clauses(&clauses, &var_pos);
-
-	uint32 lowest_total_energy = MAX_UINT32;
-	uint32 higher_energy_count = 0;
-	
-	List lowest_energy_states;
-	d_list_init(&lowest_energy_states, alloc, 4);
-
-	List forces;
-	list_init(&forces, alloc, sizeof(int32), n, true);
-	
-	List vars_with_largest_energy_swap;
-	list_init(&vars_with_largest_energy_swap, alloc, sizeof(int32), n, false);
-
-	while (true) {
-		uint32 total_energy = 0;
-		list_set_to_zero(&forces);
-
-		for (uint32 i = 0; i < clauses.length; i++) {
-			Clause triplet = list_read(&clauses, i, Clause);
-
-			uint32 v0 = triplet.i0;
-			uint32 v1 = triplet.i1;
-			uint32 v2 = triplet.i2;
-
-			uint32 pos0 = list_read(&var_pos, v0, uint32);
-			uint32 pos1 = list_read(&var_pos, v1, uint32);
-			uint32 pos2 = list_read(&var_pos, v2, uint32);
-
-			//distances are always to the right because we always keep 0 has the left most vertex
-			int32 d02 = (pos2 - pos0 + pos_count) % pos_count;
-			int32 d01 = (pos1 - pos0 + pos_count) % pos_count;
-			int32 d12 = (pos2 - pos1 + pos_count) % pos_count;
-
-			//
-			//          1
-			//         / \
-			//       /     \ 
-			//     0---------2
-			//
-			//    when variables move and switch, we update the order so that 0 is always left most
-			// so we know that 0---2 is always the longest distance
-			//since 1 is always between 0 and 2, there's no point doing anything with 1
-			//
-			//if 1 and 0 swap, we adjust
-			//   1___
-			//   |    \____
-			//    \         \ 
-			//     0---------2
-			//
-			//   0'___
-			//   |    \____
-			//    \         \ 
-			//     1'---------2
-
-			//compute forces on all three vars
-			int32 f0 = +d01 + d02 + list_read(&forces, v0, int32);
-			int32 f1 = -d01 + d12 + list_read(&forces, v1, int32);
-			int32 f2 = -d12 - d02 + list_read(&forces, v2, int32);
-			list_set(&forces, v0, &f0);
-			list_set(&forces, v1, &f1);
-			list_set(&forces, v2, &f2);
-
-			//list_print_int32(&forces);
-
-			total_energy += 2 * (d01 + d12 + d02);
-		}
-
-		//list_print_int32(&forces);
-
-		if (total_energy < lowest_total_energy) {
-			higher_energy_count = 0;
-			lowest_total_energy = total_energy;
-			//save the state
-			d_list_free(&lowest_energy_states);
-			d_list_init(&lowest_energy_states, alloc, n);
-			List* addedState = d_list_create_element_list(&lowest_energy_states, sizeof(uint32), n, true);
-
-			for (uint32 i = 0; i < n; i++) {
-				uint32 pos = list_read(&var_pos, i, uint32);
-				list_set(lowest_var_pos, i, &pos);
-				list_set(addedState, i, &pos);
-			}
-			//list_print_uint32(added_state);
-		}
-		else if (total_energy == lowest_total_energy) {
-			//check whether the state was already encountered
-			if (d_list_contains_list(&lowest_energy_states, &var_pos)) {
-				//we stop since we went back to a same low energy state.
-				for (uint32 i = 0; i < n; i++) {
-					uint32 pos = list_read(&var_pos, i, uint32);
-					uint32 var = list_read(&var_ring, i, uint32);
-					list_set(lowest_var_pos, i, &pos);
-					list_set(lowest_var_ring, i, &var);
-				}
-				break;
-			}
-			else {
-				//add the state
-				List* added_state = d_list_create_element_list(&lowest_energy_states, sizeof(uint32), n, true);
-				for (uint32 i = 0; i < n; i++) {
-					uint32 pos = list_read(&var_pos, i, uint32);
-					uint32 var = list_read(&var_ring, i, uint32);
-					list_set(lowest_var_pos, i, &pos);
-					list_set(added_state, i, &pos);
-					list_set(lowest_var_ring, i, &var);
-				}
-			}
-		}
-		else {
-			//more energy, we stop after a while
-			if (higher_energy_count > 10) {
-				break;
-			}
-			higher_energy_count++;
-		}
-
-		//now that we have all the forces on each var, we update their positions
-		//move the var with the largest force.
-
-		//look for the swap of 2 vars that gives the largest drop in energy
-		// so you add up each var's force (signed) to the force (signed) of the neighbor var is would swap with, 
-		// and look for the largest such absolute sum.
-
-		int32 largest_energy_swap = -1;
-		for (uint32 i = 0; i < forces.length; i++) {
-			int32 f = list_read(&forces, i, int32);
-			if (f == 0) continue;
-			uint32 pos = list_read(&var_pos, i, uint32);
-			uint32 swapped_var = get_next_var(pos, f, &var_ring);
-			int32 swapped_var_f = list_read(&forces, swapped_var, int32);
-			//energy change is signed, i.e. is can go up or down, but we need to take sign of force into account
-			int32 sign = f > 0 ? +1 : -1;
-			int32 energy_swap = sign * (f - swapped_var_f);
-			if (energy_swap < 0) continue;
-			if (energy_swap > largest_energy_swap) {
-				largest_energy_swap = energy_swap;
-				list_clear(&vars_with_largest_energy_swap);
-				list_add(&vars_with_largest_energy_swap, &i);
-			}
-			else if (abs(energy_swap) == abs(largest_energy_swap)) {
-				list_add(&vars_with_largest_energy_swap, &i);
-			}
-		}
-
-		if (vars_with_largest_energy_swap.length == 0) {
-			continue;
-		}
-
-		//pick one var
-		uint32 rand_index = rand_next_int(rand, vars_with_largest_energy_swap.length);
-		uint32 var_with_largest_energy_swap = list_read(&vars_with_largest_energy_swap, rand_index, uint32);
-
-		int32 picked_force = list_read(&forces, var_with_largest_energy_swap, int32);
-
-		//sort clauses by shortest total force in a list
-		// find the right var that splits the most the set of clauses (measure crossing count along the ring using directions)
-		// put that var at the start by shifting all vars
-		// find the areas with the most density of clauses
-		// for each var look in the sorted clause list for the first clause it's in and pull that clause out and process it
-		// when no more clause, go to next var to the right
-
-		//move the var in the direction of its force
-		uint32 current_pos = list_read(&var_pos,var_with_largest_energy_swap,uint32);
-		uint32 swap_var = get_next_var(current_pos, picked_force, &var_ring);
-		uint32 next_position = list_read(&var_pos,swap_var,uint32);
-
-		//list_print_uint32(&var_ring);
-
-		list_set(&var_ring, next_position, &var_with_largest_energy_swap);
-
-		list_set(&var_ring, current_pos, &swap_var);
-
-		//list_print_uint32(&var_ring);
-		//list_print_uint32(&var_pos);
-
-		list_set(&var_pos, var_with_largest_energy_swap, &next_position);
-
-		list_set(&var_pos, swap_var, &current_pos);
-
-		//list_print_uint32(&var_pos);
-
-		for (uint32 i = 0; i < n; i++) {
-			uint32 pos = list_read(&var_pos, i, uint32);
-			uint32 var = list_read(&var_ring, i, uint32);
-			list_set(lowest_var_pos, i, &pos);
-			list_set(lowest_var_ring, i, &var);
-		}
-		//adjust all triplets based on the swap between swapVar and varWithLargestForce
-		uint32 var_to_right = swap_var;
-		uint32 var_to_left = var_with_largest_energy_swap;
-		if (picked_force > 0) {
-			var_to_right = var_with_largest_energy_swap;
-			var_to_left = swap_var;
-		}
-
-		for (uint32 m = 0; m < clauses.length; m++) {
-
-			Clause triplet = list_read(&clauses,m,Clause);
-
-			uint32 v0 = triplet.i0;
-			uint32 v1 = triplet.i1;
-			uint32 v2 = triplet.i2;
-			bool b0 = triplet.b0;
-			bool b1 = triplet.b1;
-			bool b2 = triplet.b2;
-
-			bool changed = false;
-
-			if (v0 == var_to_right && v1 == var_to_left) {
-				triplet.i0 = v1;
-				triplet.i1 = v0;
-				triplet.b0 = b1;
-				triplet.b1 = b0;
-				changed = true;
-			}
-			else if (v1 == var_to_right && v2 == var_to_left) {
-				triplet.i1 = v2;
-				triplet.i2 = v1;
-				triplet.b1 = b2;
-				triplet.b2 = b1;
-				changed = true;
-			}
-			if (changed) {
-				list_set(&clauses, m, &triplet);
-			}
-		}
-	}
-	copy_clauses(&clauses, lowest_triplets);
-	check_clauses(lowest_triplets, lowest_var_pos);
-	
-	//instance_print(lowest_triplets, lowest_var_pos, lowest_var_ring, n);
-
-	list_free(&clauses);
-	list_free(&vars_with_largest_energy_swap);
-	list_free(&forces);
-	d_list_free(&lowest_energy_states);
-	list_free(&var_pos);
-	list_free(&var_ring);
-
-	return lowest_total_energy;
-}
-
 int32 clause_energy(Clause clause, List* varPos, uint32 n) {
 
 	uint32 pos0 = list_read(varPos, clause.i0, uint32);
@@ -2699,319 +2850,2422 @@ int32 clause_energy(Clause clause, List* varPos, uint32 n) {
 	return energy;
 }
 
-real32 clause_var_energy(Clause* clause, uint32 v, List* var_pos, uint32 n) {
-	uint32 v0 = clause->i0;
-	uint32 v1 = clause->i1;
-	uint32 v2 = clause->i2;
+/*
+ Returns the clause with its vars (and signs) ordered by position, i0 being the leftmost var and i2 the rightmost one.
+*/
+Clause triplet_sorted_by_pos(Clause clause, List* var_pos) {
+	Clause triplet;
+	// 0 is always the leftmost element in varPos, 2 is the rightmost, and 1 is the middle one
+	uint32 v0 = clause.i0;
+	uint32 v1 = clause.i1;
+	uint32 v2 = clause.i2;
+	bool b0 = clause.b0;
+	bool b1 = clause.b1;
+	bool b2 = clause.b2;
+
 	uint32 pos0 = list_read(var_pos, v0, uint32);
 	uint32 pos1 = list_read(var_pos, v1, uint32);
 	uint32 pos2 = list_read(var_pos, v2, uint32);
-	int32 d02 = (pos2 - pos0 + n) % n;
-	int32 d01 = (pos1 - pos0 + n) % n;
-	int32 d12 = (pos2 - pos1 + n) % n;
-	real32 energy = 0.0;
-	if (v0 == v) {
-		energy += 1.0f / ((real32)(d01 + d02));
+	if (pos0 < pos1) { // 0 < 1
+		if (pos1 < pos2) {  // 0 < 1, 1 < 2
+			// 0 < 1 < 2
+			triplet.i0 = v0;
+			triplet.i1 = v1;
+			triplet.i2 = v2;
+			triplet.b0 = b0;
+			triplet.b1 = b1;
+			triplet.b2 = b2;
+		}
+		else if (pos0 < pos2) { // 0 < 1, 2 < 1, 0 < 2
+		 //0 < 2 < 1
+			triplet.i0 = v0;
+			triplet.i1 = v2;
+			triplet.i2 = v1;
+			triplet.b0 = b0;
+			triplet.b1 = b2;
+			triplet.b2 = b1;
+		}
+		else { // 0 < 1, 2 < 1, 2 < 0
+		 //2 < 0 < 1
+			triplet.i0 = v2;
+			triplet.i1 = v0;
+			triplet.i2 = v1;
+			triplet.b0 = b2;
+			triplet.b1 = b0;
+			triplet.b2 = b1;
+		}
 	}
-	else if (v1 == v) {
-		energy += 1.0f / ((real32)(d01 + d12));
-	}
-	else if (v2 == v) {
-		energy += 1.0f / ((real32)(d12 + d02));
+	else { // 1 < 0
+		if (pos0 < pos2) { // 1 < 0, 0 < 2
+			// 1 < 0 < 2
+			triplet.i0 = v1;
+			triplet.i1 = v0;
+			triplet.i2 = v2;
+			triplet.b0 = b1;
+			triplet.b1 = b0;
+			triplet.b2 = b2;
+		}
+		else if (pos1 < pos2) { //1 < 0, 2 < 0, 1 < 2
+		 // 1 < 2 < 0
+			triplet.i0 = v1;
+			triplet.i1 = v2;
+			triplet.i2 = v0;
+			triplet.b0 = b1;
+			triplet.b1 = b2;
+			triplet.b2 = b0;
+		}
+		else { // 1 < 0, 2 < 0, 2 < 1
+		 // 2 < 1 < 0
+			triplet.i0 = v2;
+			triplet.i1 = v1;
+			triplet.i2 = v0;
+			triplet.b0 = b2;
+			triplet.b1 = b1;
+			triplet.b2 = b0;
+		}
 	}
-	return energy;
+	return triplet;
 }
 
-bool var_in_pos_range(uint32 v, List* var_ring, uint32 p0, uint32 p1) {
-	for (uint32 p = p0; p <= p1; p++) {
-		uint32 var = list_read(var_ring, p, uint32);
-		if (var == v) {
-			return true;
-		}
+/*
+ Clause vars as structure of arrays, for the energy kernels. count is padded to a multiple of 8 with (0, 0, 0)
+ clauses, which have no energy.
+*/
+struct ClauseBlock {
+	uint32 count;
+	List i0;
+	List i1;
+	List i2;
+};
+
+#define list_data(LIST,TYPE) ((TYPE*)((LIST)->alloc->address + (LIST)->index))
+
+void clause_block_init(ClauseBlock* block, List* clauses, Allocator* alloc) {
+	uint32 count = (clauses->length + 7) & ~7u;
+	if (count == 0) count = 8;
+	block->count = count;
+	list_init(&block->i0, alloc, sizeof(uint32), count, true);
+	list_init(&block->i1, alloc, sizeof(uint32), count, true);
+	list_init(&block->i2, alloc, sizeof(uint32), count, true);
+	list_set_to_zero(&block->i0);
+	list_set_to_zero(&block->i1);
+	list_set_to_zero(&block->i2);
+	uint32* i0 = list_data(&block->i0, uint32);
+	uint32* i1 = list_data(&block->i1, uint32);
+	uint32* i2 = list_data(&block->i2, uint32);
+	for (uint32 i = 0; i < clauses->length; i++) {
+		Clause c = list_read(clauses, i, Clause);
+		i0[i] = c.i0;
+		i1[i] = c.i1;
+		i2[i] = c.i2;
 	}
-	return false;
 }
 
-int32 energy_in_pos_range(List* clauses, List* clause_energy, List* var_pos, List* var_ring, uint32 n, uint32 p0, uint32 p1) {
-	int32 energy = 0;
-	for (uint32 m = 0; m < clauses->length; m++) {
-		Clause clause = list_read(clauses, m, Clause);
-		if (var_in_pos_range(clause.i0, var_ring, p0, p1) && var_in_pos_range(clause.i1, var_ring, p0, p1) && var_in_pos_range(clause.i2, var_ring, p0, p1)) {
-			int32 e = list_read(clause_energy, m, int32);
-			energy += e;
-		}
+void clause_block_free(ClauseBlock* block) {
+	list_free(&block->i2);
+	list_free(&block->i1);
+	list_free(&block->i0);
+}
+
+/*
+ clause_span_energy of the clauses [start, start + 8) of a block, 8 clauses per instruction with AVX2: the positions
+ are gathered, and 4 * (highest - lowest) is computed with the packed max and min, without a branch.
+*/
+#if THREE_SAT_AVX2
+inline __m256i clause_block_energy_8(ClauseBlock* block, uint32 start, int32* pos) {
+	__m256i v0 = _mm256_loadu_si256((__m256i*)(list_data(&block->i0, uint32) + start));
+	__m256i v1 = _mm256_loadu_si256((__m256i*)(list_data(&block->i1, uint32) + start));
+	__m256i v2 = _mm256_loadu_si256((__m256i*)(list_data(&block->i2, uint32) + start));
+	__m256i p0 = _mm256_i32gather_epi32(pos, v0, 4);
+	__m256i p1 = _mm256_i32gather_epi32(pos, v1, 4);
+	__m256i p2 = _mm256_i32gather_epi32(pos, v2, 4);
+	__m256i highest = _mm256_max_epi32(_mm256_max_epi32(p0, p1), p2);
+	__m256i lowest = _mm256_min_epi32(_mm256_min_epi32(p0, p1), p2);
+	return _mm256_slli_epi32(_mm256_sub_epi32(highest, lowest), 2);
+}
+#endif
+
+/*
+ Total clause_span_energy of the clauses of a block, without SIMD. This is the energy of the layout var_pos, the sum
+ of clause_energy of the clauses sorted by position, whatever the order of the vars in the clauses of the block:
+ so the block of an instance serves every layout of it.
+*/
+uint32 clause_block_energy_scalar(ClauseBlock* block, List* var_pos) {
+	int32* pos = list_data(var_pos, int32);
+	uint32* i0 = list_data(&block->i0, uint32);
+	uint32* i1 = list_data(&block->i1, uint32);
+	uint32* i2 = list_data(&block->i2, uint32);
+	uint32 energy = 0;
+	for (uint32 i = 0; i < block->count; i++) {
+		int32 p0 = pos[i0[i]];
+		int32 p1 = pos[i1[i]];
+		int32 p2 = pos[i2[i]];
+		int32 highest = p0 > p1 ? (p0 > p2 ? p0 : p2) : (p1 > p2 ? p1 : p2);
+		int32 lowest = p0 < p1 ? (p0 < p2 ? p0 : p2) : (p1 < p2 ? p1 : p2);
+		energy += 4 * (highest - lowest);
 	}
 	return energy;
 }
 
-void extract_clauses_in_pos_range(List* clauses, List* clause_energy, List* sorted_clauses, List* var_pos, List* var_ring, uint32 n, uint32 p0, uint32 p1) {
-	for (uint32 m = 0; m < clauses->length; m++) {
-		Clause clause = list_read(clauses, m, Clause);
-		if (var_in_pos_range(clause.i0, var_ring, p0, p1) && var_in_pos_range(clause.i1, var_ring, p0, p1) && var_in_pos_range(clause.i2, var_ring, p0, p1)) {
-			list_add(sorted_clauses, &clause);
-			list_remove(clauses, m);
-			list_remove(clause_energy, m);
-			m--;
-		}
+/*
+ clause_block_energy_scalar, with the AVX2 kernel when it is built in.
+*/
+uint32 clause_block_energy(ClauseBlock* block, List* var_pos) {
+#if THREE_SAT_AVX2
+	int32* pos = list_data(var_pos, int32);
+	__m256i total = _mm256_setzero_si256();
+	for (uint32 i = 0; i < block->count; i += 8) {
+		total = _mm256_add_epi32(total, clause_block_energy_8(block, i, pos));
+	}
+	int32 lanes[8];
+	_mm256_storeu_si256((__m256i*)lanes, total);
+	uint32 energy = 0;
+	for (uint32 k = 0; k < 8; k++) {
+		energy += lanes[k];
 	}
+	return energy;
+#else
+	return clause_block_energy_scalar(block, var_pos);
+#endif
 }
 
-void prioritize_clauses(List* final_sorted_clauses, List* var_pos, List* var_ring, uint32 n, List* clauses, Allocator* alloc) {
-
-	check_clauses(clauses, var_pos);
-
-	List clause_list;
-	list_init(&clause_list, alloc, sizeof(Clause), clauses->length, false);
-
-	List clause_energy_list;
-	list_init(&clause_energy_list, alloc, sizeof(int32), clauses->length, false);
-
-	for (uint32 m = 0; m < clauses->length; m++) {
-
-		Clause clause = list_read(clauses,m,Clause);
+/*
+ Max heap of the elements [0, count), ordered by key and then by priority (to break ties).
+ heap_index keeps the heap slot of every element, so the key of any element can be changed in O(log count).
+*/
+struct IndexedHeap {
+	List heap; //element in each heap slot
+	List heap_index; //heap slot of each element
+	List key;
+	List priority;
+};
 
-		int32 c_energy = clause_energy(clause, var_pos, n);
-		uint32 insertIndex = -1;
-		for (uint32 i = 0; i < clause_energy_list.length; i++) {
-			int32 energy = list_read(&clause_energy_list, i, int32);
-			if (energy >= c_energy) {
-				insertIndex = i;
-				break;
-			}
-		}
-		if (insertIndex != -1) {
+void indexed_heap_init(IndexedHeap* h, Allocator* alloc, uint32 count) {
+	list_init(&h->heap, alloc, sizeof(uint32), count, true);
+	list_init(&h->heap_index, alloc, sizeof(uint32), count, true);
+	list_init(&h->key, alloc, sizeof(int32), count, true);
+	list_init(&h->priority, alloc, sizeof(uint32), count, true);
+	list_set_to_zero(&h->key);
+	list_set_to_zero(&h->priority);
+	for (uint32 i = 0; i < count; i++) {
+		list_set(&h->heap, i, &i);
+		list_set(&h->heap_index, i, &i);
+	}
+}
 
-			list_insert(&clause_list, insertIndex, &clause);
-			list_insert(&clause_energy_list, insertIndex, &c_energy);
-		}
-		else {
+void indexed_heap_free(IndexedHeap* h) {
+	list_free(&h->priority);
+	list_free(&h->key);
+	list_free(&h->heap_index);
+	list_free(&h->heap);
+}
 
-			list_add(&clause_list, &clause);
-			list_add(&clause_energy_list, &c_energy);
-		}
+//true if element a should be above element b
+bool indexed_heap_before(IndexedHeap* h, uint32 a, uint32 b) {
+	int32 ka = list_read(&h->key, a, int32);
+	int32 kb = list_read(&h->key, b, int32);
+	if (ka != kb) {
+		return ka > kb;
 	}
+	return list_read(&h->priority, a, uint32) > list_read(&h->priority, b, uint32);
+}
 
-	//list_print_int32(&clause_energy_list);
-
-	real32 max_energy = 0.0;
-	uint32 max_energy_var = -1;
-	uint32 v_index = -1;
+void indexed_heap_swap_slots(IndexedHeap* h, uint32 s0, uint32 s1) {
+	uint32 e0 = list_read(&h->heap, s0, uint32);
+	uint32 e1 = list_read(&h->heap, s1, uint32);
+	list_set(&h->heap, s0, &e1);
+	list_set(&h->heap, s1, &e0);
+	list_set(&h->heap_index, e1, &s0);
+	list_set(&h->heap_index, e0, &s1);
+}
 
-	list_clear(final_sorted_clauses);
-	for (uint32 v = 0; v < n; v++) {
-		real32 var_energy = 0;
-		for (uint32 m = 0; m < clause_list.length; m++) {
-			Clause clause = list_read(&clause_list, m, Clause);
-			if (clause_contains_var(&clause, v)) {
-				var_energy += clause_var_energy(&clause, v, var_pos, n);
-			}
-		}
-		if (var_energy > max_energy) {
-			max_energy_var = v;
-			max_energy = var_energy;
+void indexed_heap_sift_up(IndexedHeap* h, uint32 slot) {
+	while (slot > 0) {
+		uint32 parent = (slot - 1) / 2;
+		if (!indexed_heap_before(h, list_read(&h->heap, slot, uint32), list_read(&h->heap, parent, uint32))) {
+			break;
 		}
+		indexed_heap_swap_slots(h, slot, parent);
+		slot = parent;
 	}
-	
-	//start at v = max_energy_var
-	//build three sets  v,v+1,v+2
-	//use var_ring to define the current set, with a min and a max
-	uint32 p = list_read(var_pos, max_energy_var, uint32);
-	uint32 p0 = p;
-	uint32 p1 = p;
-	uint32 range = 1;
+}
 
+void indexed_heap_sift_down(IndexedHeap* h, uint32 slot) {
+	uint32 count = h->heap.length;
 	while (true) {
-		int32 energy_max = 0;
-		for (uint32 i = 0; i < range; i++) {
-			int32 r0 = p - (range - 1) + i;
-			uint32 r1 = p + i;
-			if (r0 < 0 || r1 >= n) continue;
-			int32 energy = energy_in_pos_range(&clause_list, &clause_energy_list, var_pos, var_ring, n, r0, r1);
-			if (energy > energy_max) {
-				energy_max = energy;
-				p0 = r0;
-				p1 = r1;
-			}
+		uint32 first = slot;
+		uint32 left = 2 * slot + 1;
+		uint32 right = left + 1;
+		if (left < count && indexed_heap_before(h, list_read(&h->heap, left, uint32), list_read(&h->heap, first, uint32))) {
+			first = left;
+		}
+		if (right < count && indexed_heap_before(h, list_read(&h->heap, right, uint32), list_read(&h->heap, first, uint32))) {
+			first = right;
 		}
-		if (energy_max > 0) {
+		if (first == slot) {
 			break;
 		}
-		range++;
+		indexed_heap_swap_slots(h, slot, first);
+		slot = first;
 	}
-	//list_print_int32(&clause_energy_list);
-	extract_clauses_in_pos_range(&clause_list, &clause_energy_list, final_sorted_clauses, var_pos, var_ring, n, p0, p1);
+}
 
-	//list_print_int32(&clause_energy_list);
-	uint32 ii = 0;
-	while (true) {
-		if (clause_list.length == 0) break;
-		//try expanding range
-		//expand range to the left by one
-		int32 energy_left = -1;
-		int32 energy_right = -1;
-		uint32 p00 = p0 - 1;
-		if (p00 != -1) {
-			energy_left = energy_in_pos_range(&clause_list, &clause_energy_list, var_pos, var_ring, n, p00, p1);
-		}
-		uint32 p11 = p1 + 1;
-		if (p11 < n) {
-			energy_right = energy_in_pos_range(&clause_list, &clause_energy_list, var_pos, var_ring, n, p0, p11);
-		}
-		if (energy_right > energy_left) {
-			p1 = p11;
-		}
-		else {
-			p0 = p00;
-		}
+//restores the heap order after keys were set directly in h->key
+void indexed_heap_build(IndexedHeap* h) {
+	for (uint32 slot = h->heap.length / 2; slot-- > 0;) {
+		indexed_heap_sift_down(h, slot);
+	}
+}
 
-		extract_clauses_in_pos_range(&clause_list, &clause_energy_list, final_sorted_clauses, var_pos, var_ring, n, p0, p1);
+void indexed_heap_set(IndexedHeap* h, uint32 element, int32 key) {
+	int32 old_key = list_read(&h->key, element, int32);
+	list_set(&h->key, element, &key);
+	uint32 slot = list_read(&h->heap_index, element, uint32);
+	if (key > old_key) {
+		indexed_heap_sift_up(h, slot);
 	}
-	
-	check_clauses(final_sorted_clauses, var_pos);
-	list_free(&clause_energy_list);
-	list_free(&clause_list);
+	else if (key < old_key) {
+		indexed_heap_sift_down(h, slot);
+	}
+}
+
+uint32 indexed_heap_top(IndexedHeap* h) {
+	return list_read(&h->heap, 0, uint32);
 }
 
 /*
- Optimize a given instance by re-arranging the order of its variables and clauses.
+ Exact energy change when swapping the vars at ring positions left_pos and left_pos + 1.
+ Clause vars are kept in ring order (the arc starts at i0, goes through i1 and ends at i2), so a clause energy is
+ 4 times the length of its arc. The var moving right (l) shortens the arcs it starts and lengthens the arcs it ends,
+ the var moving left (r) does the opposite, and a clause that contains both vars keeps its arc (the two vars swap
+ their labels). Only the clauses touching l and r are visited.
 */
-int optimize_instance(List* instance, uint32 n, List* optimized_var_pos, List* optimized_var_ring, List* optimized_instance, uint32 seed, Allocator* alloc) {
+int32 swap_delta(List* triplets, List* var_clause_start, List* var_clauses, List* var_ring, uint32 n, uint32 left_pos) {
+	uint32 l = list_read(var_ring, left_pos, uint32);
+	uint32 r = list_read(var_ring, (left_pos + 1) % n, uint32);
+	int32 delta = 0;
+	uint32 start = list_read(var_clause_start, l, uint32);
+	uint32 end = list_read(var_clause_start, l + 1, uint32);
+	for (uint32 k = start; k < end; k++) {
+		Clause* triplet = (Clause*)list_read_(triplets, list_read(var_clauses, k, uint32), sizeof(Clause));
+		if (clause_contains_var(triplet, r)) continue;
+		if (triplet->i0 == l) delta -= 4;
+		else if (triplet->i2 == l) delta += 4;
+	}
+	start = list_read(var_clause_start, r, uint32);
+	end = list_read(var_clause_start, r + 1, uint32);
+	for (uint32 k = start; k < end; k++) {
+		Clause* triplet = (Clause*)list_read_(triplets, list_read(var_clauses, k, uint32), sizeof(Clause));
+		if (clause_contains_var(triplet, l)) continue;
+		if (triplet->i0 == r) delta += 4;
+		else if (triplet->i2 == r) delta -= 4;
+	}
+	return delta;
+}
 
-	mem_index start_alloc_size = alloc->free_size;
+/*
+ Local search on the ring of variables: repeatedly applies the adjacent swap with the largest exact energy drop.
+ The energy change of each of the n adjacent swaps is kept in an indexed max heap; a swap only changes the
+ entries of the swapped pair and of its two neighbouring pairs, so a step costs O(degree * log n).
+ lowest_var_pos / lowest_var_ring receive the lowest energy layout found, and lowest_triplets the clauses with
+ their vars ordered by (linear) position in that layout.
+*/
+uint32 optimize(List* instance, ClauseBlock* block, uint32 n, List* in_var_pos, List* lowest_var_pos, List* lowest_var_ring, List* lowest_triplets, Rand* rand, Allocator* alloc) {
 
-	Rand rand;
-	rand_set_seed(&rand, seed);
+	//this one assumes all clauses are 3 and treats them as a triangle, so we optimize
+	// only on the longest segment
 
-	List in_var_pos;
-	list_init(&in_var_pos, alloc, sizeof(uint32), n, true);
+	//var_ring[x] is the index of the var at position x
+	List var_ring;
+	list_init(&var_ring, alloc, sizeof(uint32), n, true);
 
-	for (uint32 i = 0; i < n; i++) {
-		list_set(&in_var_pos, i, &i); 
+	//var_pos[v] is the position of variable v
+	List var_pos;
+	list_init(&var_pos, alloc, sizeof(uint32), n, true);
+
+	for (uint32 v = 0; v < n; v++) {
+		uint32 pos = list_read(in_var_pos, v, uint32);
+		list_set(&var_pos, v, &pos);
+		list_set(&var_ring, pos, &v);
 	}
 
-	//list_print_uint32(&in_var_pos);
+	List clauses;
+	uint32 m = instance->length;
+	list_init(&clauses, alloc, sizeof(Clause), m, false);
+	//transform clauses into 0 based unsigned lists
+	for (uint32 i = 0; i < m; i++) {
+		Clause triplet = triplet_sorted_by_pos(list_read(instance, i, Clause), &var_pos);
+		list_add(&clauses, &triplet);
+	}
+
+	check_clauses(&clauses, &var_pos);
+
+	//var_clauses[var_clause_start[v] .. var_clause_start[v + 1]] are the indices of the clauses containing v
+	List var_clause_start;
+	list_init(&var_clause_start, alloc, sizeof(uint32), n + 1, true);
+	list_set_to_zero(&var_clause_start);
+	List var_clauses;
+	list_init(&var_clauses, alloc, sizeof(uint32), 3 * m > 0 ? 3 * m : 1, true);
+	for (uint32 i = 0; i < m; i++) {
+		Clause c = list_read(&clauses, i, Clause);
+		uint32 vars[3] = { c.i0, c.i1, c.i2 };
+		for (uint32 k = 0; k < 3; k++) {
+			uint32 count = list_read(&var_clause_start, vars[k] + 1, uint32) + 1;
+			list_set(&var_clause_start, vars[k] + 1, &count);
+		}
+	}
+	for (uint32 v = 0; v < n; v++) {
+		uint32 start = list_read(&var_clause_start, v, uint32) + list_read(&var_clause_start, v + 1, uint32);
+		list_set(&var_clause_start, v + 1, &start);
+	}
+	List var_fill;
+	list_init(&var_fill, alloc, sizeof(uint32), n, true);
+	for (uint32 v = 0; v < n; v++) {
+		uint32 start = list_read(&var_clause_start, v, uint32);
+		list_set(&var_fill, v, &start);
+	}
+	for (uint32 i = 0; i < m; i++) {
+		Clause c = list_read(&clauses, i, Clause);
+		uint32 vars[3] = { c.i0, c.i1, c.i2 };
+		for (uint32 k = 0; k < 3; k++) {
+			uint32 slot = list_read(&var_fill, vars[k], uint32);
+			list_set(&var_clauses, slot, &i);
+			slot++;
+			list_set(&var_fill, vars[k], &slot);
+		}
+	}
+	list_free(&var_fill);
+
+	uint32 total_energy = clause_block_energy(block, &var_pos);
+
+	//heap entry p is the swap of the vars at positions p and p + 1 (on the ring), keyed by the energy drop.
+	//ties between equal drops are broken by a random priority per position.
+	IndexedHeap swaps;
+	indexed_heap_init(&swaps, alloc, n);
+	for (uint32 p = 0; p < n; p++) {
+		uint32 priority = rand_next_int(rand);
+		list_set(&swaps.priority, p, &priority);
+		int32 drop = -swap_delta(&clauses, &var_clause_start, &var_clauses, &var_ring, n, p);
+		list_set(&swaps.key, p, &drop);
+	}
+	indexed_heap_build(&swaps);
 
-	uint32 count = 0;
 	uint32 lowest_total_energy = MAX_UINT32;
+	uint32 higher_energy_count = 0;
 
-	List out_var_pos;
-	list_init(&out_var_pos, alloc, sizeof(uint32), n, true);
-	List out_var_ring;
-	list_init(&out_var_ring, alloc, sizeof(uint32), n, true);
-	List out_instance;
-	list_init(&out_instance, alloc, sizeof(Clause), n, false);
-	List lowest_energy_instance;
-	list_init(&lowest_energy_instance, alloc, sizeof(Clause), n, false);
+	//hashes of the rings already visited at the current lowest energy
+	HashSet lowest_energy_states;
+	hash_set_init(&lowest_energy_states, alloc, 64);
 
-	while (count < 100) { //we rerun the optimization with different initial var list
+	uint64 state_hash = ring_hash(&var_ring, n);
 
-		//shuffle the variable positions
-		for (uint32 i = 0; i < n; i++) {
-			int rng = n - i;
-			uint32 p = i + rand_next_int(&rand, rng);
-			uint32 var_p = list_read(&in_var_pos, p, uint32);
-			uint32 var_i = list_read(&in_var_pos, i, uint32);
-			list_set(&in_var_pos, p, &var_i);
-			list_set(&in_var_pos, i, &var_p);
-		}
-		//list_print_uint32(&in_var_pos);
-		
-		uint32 total_energy = optimize(instance, n, &in_var_pos, &out_var_pos, &out_var_ring, &out_instance, &rand, alloc);
-		
+	while (true) {
+
+		bool save_state = false;
 		if (total_energy < lowest_total_energy) {
+			higher_energy_count = 0;
 			lowest_total_energy = total_energy;
+			hash_set_clear(&lowest_energy_states);
+			hash_set_add(&lowest_energy_states, state_hash);
+			save_state = true;
+		}
+		else if (total_energy == lowest_total_energy) {
+			//check whether the state (or one of its rotations) was already encountered
+			if (!hash_set_add(&lowest_energy_states, state_hash)) {
+				//we stop since we went back to a same low energy state.
+				break;
+			}
+			save_state = true;
+		}
+		else {
+			//more energy, we stop after a while
+			if (higher_energy_count > 10) {
+				break;
+			}
+			higher_energy_count++;
+		}
+
+		if (save_state) {
 			for (uint32 i = 0; i < n; i++) {
-				uint32 pos = list_read(&out_var_pos, i, uint32);
-				uint32 var = list_read(&out_var_ring, i, uint32);
-				list_set(optimized_var_pos, i, &pos);
-				list_set(optimized_var_ring, i, &var);
+				uint32 pos = list_read(&var_pos, i, uint32);
+				uint32 var = list_read(&var_ring, i, uint32);
+				list_set(lowest_var_pos, i, &pos);
+				list_set(lowest_var_ring, i, &var);
 			}
-			copy_clauses(&out_instance, &lowest_energy_instance);
-			check_clauses(&lowest_energy_instance, optimized_var_pos);
 		}
-		
-		//reset positions
-		for (uint32 i = 0; i < n; i++) {
-			list_set(&in_var_pos, i, &i);
+
+		//apply the swap with the largest energy drop (or the smallest increase when we're in a local minimum)
+		PROFILE_COUNT(COUNTER_OPTIMIZE_ITERATIONS, 1);
+		PROFILE_COUNT(COUNTER_SWAPS, 1);
+		uint32 left_pos = indexed_heap_top(&swaps);
+		int32 drop = list_read(&swaps.key, left_pos, int32);
+		uint32 right_pos = (left_pos + 1) % n;
+		uint32 var_to_right = list_read(&var_ring, left_pos, uint32);
+		uint32 var_to_left = list_read(&var_ring, right_pos, uint32);
+
+		state_hash = ring_hash_swap(state_hash, &var_ring, n, left_pos);
+
+		list_set(&var_ring, left_pos, &var_to_left);
+		list_set(&var_ring, right_pos, &var_to_right);
+		list_set(&var_pos, var_to_left, &left_pos);
+		list_set(&var_pos, var_to_right, &right_pos);
+		total_energy -= drop;
+
+		//the two vars swap their labels in the clauses that contain both, so vars stay in ring order
+		uint32 start = list_read(&var_clause_start, var_to_right, uint32);
+		uint32 end = list_read(&var_clause_start, var_to_right + 1, uint32);
+		for (uint32 k = start; k < end; k++) {
+			Clause* triplet = (Clause*)list_read_(&clauses, list_read(&var_clauses, k, uint32), sizeof(Clause));
+			if (!clause_contains_var(triplet, var_to_left)) continue;
+			uint32 vars[3] = { triplet->i0, triplet->i1, triplet->i2 };
+			bool signs[3] = { triplet->b0, triplet->b1, triplet->b2 };
+			uint32 a = clause_find_index(triplet, var_to_right);
+			uint32 b = clause_find_index(triplet, var_to_left);
+			uint32 v = vars[a];
+			vars[a] = vars[b];
+			vars[b] = v;
+			bool s = signs[a];
+			signs[a] = signs[b];
+			signs[b] = s;
+			triplet->i0 = vars[0];
+			triplet->i1 = vars[1];
+			triplet->i2 = vars[2];
+			triplet->b0 = signs[0];
+			triplet->b1 = signs[1];
+			triplet->b2 = signs[2];
 		}
-		count++;
-	}
 
-	prioritize_clauses(optimized_instance, optimized_var_pos, optimized_var_ring, n, &lowest_energy_instance, alloc);
+		//only the swapped pair and its two neighbouring pairs changed
+		uint32 update_pos[3] = { (left_pos + n - 1) % n, left_pos, right_pos };
+		for (uint32 k = 0; k < 3; k++) {
+			if (k > 0 && update_pos[k] == update_pos[0]) continue;
+			int32 new_drop = -swap_delta(&clauses, &var_clause_start, &var_clauses, &var_ring, n, update_pos[k]);
+			indexed_heap_set(&swaps, update_pos[k], new_drop);
+		}
+	}
 
-	list_free(&in_var_pos);
-	list_free(&out_var_pos);
-	list_free(&out_var_ring);
-	list_free(&out_instance);
-	list_free(&lowest_energy_instance);
+	//output the clauses ordered by position in the lowest energy layout
+	list_clear(lowest_triplets);
+	for (uint32 i = 0; i < m; i++) {
+		Clause triplet = triplet_sorted_by_pos(list_read(instance, i, Clause), lowest_var_pos);
+		list_add(lowest_triplets, &triplet);
+	}
+	check_clauses(lowest_triplets, lowest_var_pos);
 
-	mem_index end_alloc_size = alloc->free_size;
+	//instance_print(lowest_triplets, lowest_var_pos, lowest_var_ring, n);
 
-	assert(start_alloc_size == end_alloc_size, "");
+	hash_set_free(&lowest_energy_states);
+	indexed_heap_free(&swaps);
+	list_free(&var_clauses);
+	list_free(&var_clause_start);
+	list_free(&clauses);
+	list_free(&var_pos);
+	list_free(&var_ring);
 
 	return lowest_total_energy;
 }
 
-void transform_solution(List* in_solution, List* out_solution, List* out_var_ring, uint32 n) {
-	for (uint32 i = 0; i < n; i++) {
-		bool v = list_read(in_solution, i, bool);
-		uint32 pos = list_read(out_var_ring, i, uint32);
-		list_set(out_solution, pos, &v);
+real32 clause_var_energy(Clause* clause, uint32 v, List* var_pos, uint32 n) {
+	uint32 v0 = clause->i0;
+	uint32 v1 = clause->i1;
+	uint32 v2 = clause->i2;
+	uint32 pos0 = list_read(var_pos, v0, uint32);
+	uint32 pos1 = list_read(var_pos, v1, uint32);
+	uint32 pos2 = list_read(var_pos, v2, uint32);
+	int32 d02 = (pos2 - pos0 + n) % n;
+	int32 d01 = (pos1 - pos0 + n) % n;
+	int32 d12 = (pos2 - pos1 + n) % n;
+	real32 energy = 0.0;
+	if (v0 == v) {
+		energy += 1.0f / ((real32)(d01 + d02));
+	}
+	else if (v1 == v) {
+		energy += 1.0f / ((real32)(d01 + d12));
+	}
+	else if (v2 == v) {
+		energy += 1.0f / ((real32)(d12 + d02));
 	}
+	return energy;
 }
 
 /*
- Swap variable order.
+ Sorts indices in increasing order of keys[index] (a list of real64). The sort is stable (merge sort).
 */
-void transform_instance(List* var_pos, List* var_ring, uint32 n, List* clauses, List* transformed_clauses) {
-
-	//example
-	//var pos:  3, 2, 4, 1, 0, 12, 9, 13, 5, 10, 15, 14, 6, 7, 11, 8
-	//var ring: 4, 3, 1, 0, 2, 8, 12, 13, 15, 6, 9, 14, 5, 7, 11, 10
-	//clauses:
-	//[-2,-9,+10, -0,+12,+15, +2,-8,-15, -15,+6,-11, +13,+6,+9, -8,-13,-9,...
-
-	list_clear(transformed_clauses);
-	
-	for(uint32 i = 0; i < clauses->length; i++) {
-		Clause clause = list_read(clauses, i, Clause);
-		uint32 v0 = list_read(var_pos, clause.i0, uint32);
-		uint32 v1 = list_read(var_pos, clause.i1, uint32);
-		uint32 v2 = list_read(var_pos, clause.i2, uint32);
-		clause.i0 = v0;
-		clause.i1 = v1;
-		clause.i2 = v2;
-		list_add(transformed_clauses, &clause);
+void sort_indices(List* indices, List* keys, Allocator* alloc) {
+	uint32 count = indices->length;
+	if (count < 2) return;
+	List tmp;
+	list_init(&tmp, alloc, sizeof(uint32), count, true);
+	List* src = indices;
+	List* dst = &tmp;
+	for (uint32 width = 1; width < count; width *= 2) {
+		for (uint32 lo = 0; lo < count; lo += 2 * width) {
+			uint32 mid = lo + width < count ? lo + width : count;
+			uint32 hi = lo + 2 * width < count ? lo + 2 * width : count;
+			uint32 a = lo;
+			uint32 b = mid;
+			for (uint32 k = lo; k < hi; k++) {
+				uint32 ia = a < mid ? list_read(src, a, uint32) : 0;
+				uint32 ib = b < hi ? list_read(src, b, uint32) : 0;
+				if (a < mid && (b >= hi || list_read(keys, ia, real64) <= list_read(keys, ib, real64))) {
+					list_set(dst, k, &ia);
+					a++;
+				}
+				else {
+					list_set(dst, k, &ib);
+					b++;
+				}
+			}
+		}
+		List* t = src;
+		src = dst;
+		dst = t;
+	}
+	if (src != indices) {
+		for (uint32 k = 0; k < count; k++) {
+			uint32 index = list_read(src, k, uint32);
+			list_set(indices, k, &index);
+		}
 	}
+	list_free(&tmp);
 }
 
-bool test_solution(List* instance, List* solution, uint32 n, bool verbose) {
-	
-	if (verbose) {
-		
-		printf("\nSolution = ");
-		list_print_bool(solution);
+/*
+ Fenwick tree over a list of int32 (all zero at first): point updates and prefix sums in O(log n).
+*/
+void fenwick_add(List* tree, uint32 index, int32 value) {
+	for (uint32 i = index + 1; i <= tree->length; i += i & (~i + 1)) {
+		int32 sum = list_read(tree, i - 1, int32) + value;
+		list_set(tree, i - 1, &sum);
 	}
-	for (uint32 i = 0; i < instance->length; i++) {
-		Clause c = list_read(instance, i , Clause);
-		bool b0 = list_read(solution, c.i0, bool);
-		bool b1 = list_read(solution, c.i1, bool);
-		bool b2 = list_read(solution, c.i2, bool);
-		bool s = clause_is_satisfied(&c, b0, b1, b2);
+}
 
-		if (!s) {
-			char buffer[100];
-			sprintf_s(buffer, "SOLUTION FAILING: clause (%d,%d,%d) failed for values %d,%d,%d \n", (c.b0? c.i0: -1*c.i0), (c.b1 ? c.i1 : -1*c.i1), (c.b2 ? c.i2 : -1*c.i2), b0, b1, b2);
-			printf(buffer);
-			assert(s, buffer);
-			return false;
-		}
+//sum of the values at [0, index)
+int32 fenwick_prefix_sum(List* tree, uint32 index) {
+	int32 sum = 0;
+	for (uint32 i = index; i > 0; i -= i & (~i + 1)) {
+		sum += list_read(tree, i - 1, int32);
 	}
-	if (verbose) printf("SOLUTION PASSES!\n");
-	return true;
+	return sum;
 }
 
-void shuffle_instance_and_check_size(List* instance, List* min_size_instance, List* max_size_instance, List* min_sizes, List* max_sizes, int n, bool shuffle, uint32 shuffle_count, Rand* rand, Allocator* alloc) {
+/*
+ Buckets the clause ranks by a position key (CSR: bucket_start has n + 1 entries), and sorts every bucket
+ by the given order key.
+*/
+void bucket_clauses_by_pos(uint32 m, List* bucket_pos, List* order_pos, uint32 n, List* bucket_start, List* buckets, Allocator* alloc) {
+	List keys;
+	list_init(&keys, alloc, sizeof(real64), m, true);
+	for (uint32 r = 0; r < m; r++) {
+		real64 key = (real64)list_read(bucket_pos, r, uint32) * n + list_read(order_pos, r, uint32);
+		list_set(&keys, r, &key);
+	}
+	for (uint32 r = 0; r < m; r++) {
+		list_set(buckets, r, &r);
+	}
+	sort_indices(buckets, &keys, alloc);
+	list_set_to_zero(bucket_start);
+	for (uint32 r = 0; r < m; r++) {
+		uint32 b = list_read(bucket_pos, r, uint32);
+		uint32 count = list_read(bucket_start, b + 1, uint32) + 1;
+		list_set(bucket_start, b + 1, &count);
+	}
+	for (uint32 p = 0; p < n; p++) {
+		uint32 start = list_read(bucket_start, p, uint32) + list_read(bucket_start, p + 1, uint32);
+		list_set(bucket_start, p + 1, &start);
+	}
+	list_free(&keys);
+}
+
+/*
+ First index in buckets[start, end) whose clause has a position (in pos) at least equal to p, the bucket being sorted by pos.
+*/
+uint32 bucket_lower_bound(List* buckets, uint32 start, uint32 end, List* pos, uint32 p) {
+	while (start < end) {
+		uint32 middle = start + (end - start) / 2;
+		if (list_read(pos, list_read(buckets, middle, uint32), uint32) < p) {
+			start = middle + 1;
+		}
+		else {
+			end = middle;
+		}
+	}
+	return start;
+}
+
+/*
+ Appends the ranks buckets[start, end) to the sorted clauses, in rank order.
+*/
+void extract_ranked_clauses(List* buckets, uint32 start, uint32 end, List* ranked_clauses, List* sorted_clauses, List* rank_key, List* extracted, Allocator* alloc) {
+	list_clear(extracted);
+	for (uint32 k = start; k < end; k++) {
+		uint32 r = list_read(buckets, k, uint32);
+		list_add(extracted, &r);
+	}
+	if (extracted->length > 16) {
+		sort_indices(extracted, rank_key, alloc);
+	}
+	else {
+		//insertion sort, the common case being a couple of clauses
+		for (uint32 i = 1; i < extracted->length; i++) {
+			uint32 r = list_read(extracted, i, uint32);
+			uint32 j = i;
+			while (j > 0 && list_read(extracted, j - 1, uint32) > r) {
+				uint32 previous = list_read(extracted, j - 1, uint32);
+				list_set(extracted, j, &previous);
+				j--;
+			}
+			list_set(extracted, j, &r);
+		}
+	}
+	for (uint32 k = 0; k < extracted->length; k++) {
+		Clause clause = list_read(ranked_clauses, list_read(extracted, k, uint32), Clause);
+		list_add(sorted_clauses, &clause);
+	}
+}
+
+/*
+ Orders the clauses (triplets sorted by position) for the solver: starting from the densest window of positions around
+ the var of highest energy, the window grows by one position at a time, towards the side that completes the most
+ clause energy, and the clauses that fall inside are appended, lowest energy first.
+
+ Each clause is the interval [pos(i0), pos(i2)]. A clause becomes part of the window when the window first covers its
+ interval, so growing the window to the left adds the clauses starting at the new position and ending inside, and
+ growing it to the right the ones ending at the new position and starting inside: both are a prefix (or suffix) of
+ a bucket sorted by the other end, read from prefix sums. O(m log m).
+*/
+void prioritize_clauses(List* final_sorted_clauses, List* var_pos, uint32 n, List* clauses, Allocator* alloc) {
+	PROFILE_SCOPE(PHASE_PRIORITIZE);
+
+	check_clauses(clauses, var_pos);
+	list_clear(final_sorted_clauses);
+	uint32 m = clauses->length;
+	if (m == 0) return;
+
+	//rank the clauses by energy; equal energies are ranked in reverse order of the input
+	List order;
+	list_init(&order, alloc, sizeof(uint32), m, true);
+	List energy_key;
+	list_init(&energy_key, alloc, sizeof(real64), m, true);
+	for (uint32 i = 0; i < m; i++) {
+		uint32 reversed = m - 1 - i;
+		list_set(&order, i, &reversed);
+		real64 energy = (real64)clause_energy(list_read(clauses, i, Clause), var_pos, n);
+		list_set(&energy_key, i, &energy);
+	}
+	sort_indices(&order, &energy_key, alloc);
+
+	List ranked_clauses;
+	list_init(&ranked_clauses, alloc, sizeof(Clause), m, true);
+	List ranked_energy;
+	list_init(&ranked_energy, alloc, sizeof(int32), m, true);
+	List low_pos;
+	list_init(&low_pos, alloc, sizeof(uint32), m, true);
+	List high_pos;
+	list_init(&high_pos, alloc, sizeof(uint32), m, true);
+	List rank_key;
+	list_init(&rank_key, alloc, sizeof(real64), m, true);
+	for (uint32 r = 0; r < m; r++) {
+		uint32 i = list_read(&order, r, uint32);
+		Clause clause = list_read(clauses, i, Clause);
+		int32 energy = (int32)list_read(&energy_key, i, real64);
+		uint32 low = list_read(var_pos, clause.i0, uint32);
+		uint32 high = list_read(var_pos, clause.i2, uint32);
+		real64 key = (real64)r;
+		list_set(&ranked_clauses, r, &clause);
+		list_set(&ranked_energy, r, &energy);
+		list_set(&low_pos, r, &low);
+		list_set(&high_pos, r, &high);
+		list_set(&rank_key, r, &key);
+	}
+
+	//var of highest energy, summed in rank order
+	List var_energy;
+	list_init(&var_energy, alloc, sizeof(real32), n, true);
+	list_set_to_zero(&var_energy);
+	for (uint32 r = 0; r < m; r++) {
+		Clause clause = list_read(&ranked_clauses, r, Clause);
+		uint32 vars[3] = { clause.i0, clause.i1, clause.i2 };
+		for (uint32 k = 0; k < 3; k++) {
+			real32 e = list_read(&var_energy, vars[k], real32) + clause_var_energy(&clause, vars[k], var_pos, n);
+			list_set(&var_energy, vars[k], &e);
+		}
+	}
+	real32 max_energy = 0.0;
+	uint32 max_energy_var = 0;
+	for (uint32 v = 0; v < n; v++) {
+		real32 e = list_read(&var_energy, v, real32);
+		if (e > max_energy) {
+			max_energy_var = v;
+			max_energy = e;
+		}
+	}
+
+	//clauses bucketed by their leftmost position (sorted by rightmost position), and the other way around
+	List low_start;
+	list_init(&low_start, alloc, sizeof(uint32), n + 1, true);
+	List low_buckets;
+	list_init(&low_buckets, alloc, sizeof(uint32), m, true);
+	bucket_clauses_by_pos(m, &low_pos, &high_pos, n, &low_start, &low_buckets, alloc);
+	List high_start;
+	list_init(&high_start, alloc, sizeof(uint32), n + 1, true);
+	List high_buckets;
+	list_init(&high_buckets, alloc, sizeof(uint32), m, true);
+	bucket_clauses_by_pos(m, &high_pos, &low_pos, n, &high_start, &high_buckets, alloc);
+
+	//energy prefix sums over every bucket
+	List low_energy_sum;
+	list_init(&low_energy_sum, alloc, sizeof(int32), m + 1, true);
+	List high_energy_sum;
+	list_init(&high_energy_sum, alloc, sizeof(int32), m + 1, true);
+	int32 zero = 0;
+	list_set(&low_energy_sum, 0, &zero);
+	list_set(&high_energy_sum, 0, &zero);
+	for (uint32 k = 0; k < m; k++) {
+		int32 low_sum = list_read(&low_energy_sum, k, int32) + list_read(&ranked_energy, list_read(&low_buckets, k, uint32), int32);
+		int32 high_sum = list_read(&high_energy_sum, k, int32) + list_read(&ranked_energy, list_read(&high_buckets, k, uint32), int32);
+		list_set(&low_energy_sum, k + 1, &low_sum);
+		list_set(&high_energy_sum, k + 1, &high_sum);
+	}
+
+	//the first window is the densest window of the smallest width, around p, that holds a whole clause
+	uint32 p = list_read(var_pos, max_energy_var, uint32);
+	uint32 range = n;
+	for (uint32 r = 0; r < m; r++) {
+		uint32 low = list_read(&low_pos, r, uint32);
+		uint32 high = list_read(&high_pos, r, uint32);
+		uint32 width = (high > p ? high : p) - (low < p ? low : p) + 1;
+		if (width < range) range = width;
+	}
+	//window energies, for windows sorted by their right end: add the clauses ending inside to a Fenwick tree by their left end
+	List fenwick;
+	list_init(&fenwick, alloc, sizeof(int32), n, true);
+	list_set_to_zero(&fenwick);
+	int32 energy_max = 0;
+	uint32 p0 = p;
+	uint32 p1 = p;
+	uint32 k = 0;
+	int32 added_energy = 0;
+	for (uint32 i = 0; i < range; i++) {
+		int32 r0 = p - (range - 1) + i;
+		uint32 r1 = p + i;
+		if (r0 < 0 || r1 >= n) continue;
+		while (k < m && list_read(&high_pos, list_read(&high_buckets, k, uint32), uint32) <= r1) {
+			uint32 r = list_read(&high_buckets, k, uint32);
+			int32 energy = list_read(&ranked_energy, r, int32);
+			fenwick_add(&fenwick, list_read(&low_pos, r, uint32), energy);
+			added_energy += energy;
+			k++;
+		}
+		int32 energy = added_energy - fenwick_prefix_sum(&fenwick, r0);
+		if (energy > energy_max) {
+			energy_max = energy;
+			p0 = r0;
+			p1 = r1;
+		}
+	}
+
+	List extracted;
+	list_init(&extracted, alloc, sizeof(uint32), 16, false);
+	uint32 extracted_count = 0;
+	for (uint32 r = 0; r < m; r++) {
+		if (list_read(&low_pos, r, uint32) >= p0 && list_read(&high_pos, r, uint32) <= p1) {
+			Clause clause = list_read(&ranked_clauses, r, Clause);
+			list_add(final_sorted_clauses, &clause);
+			extracted_count++;
+		}
+	}
+
+	while (extracted_count < m) {
+		//clauses starting at p0 - 1 and ending at most at p1
+		int32 energy_left = -1;
+		uint32 left_start = 0;
+		uint32 left_end = 0;
+		if (p0 > 0) {
+			left_start = list_read(&low_start, p0 - 1, uint32);
+			left_end = bucket_lower_bound(&low_buckets, left_start, list_read(&low_start, p0, uint32), &high_pos, p1 + 1);
+			energy_left = list_read(&low_energy_sum, left_end, int32) - list_read(&low_energy_sum, left_start, int32);
+		}
+		//clauses ending at p1 + 1 and starting at least at p0
+		int32 energy_right = -1;
+		uint32 right_start = 0;
+		uint32 right_end = 0;
+		if (p1 + 1 < n) {
+			right_end = list_read(&high_start, p1 + 2, uint32);
+			right_start = bucket_lower_bound(&high_buckets, list_read(&high_start, p1 + 1, uint32), right_end, &low_pos, p0);
+			energy_right = list_read(&high_energy_sum, right_end, int32) - list_read(&high_energy_sum, right_start, int32);
+		}
+		if (energy_right > energy_left) {
+			p1++;
+			extract_ranked_clauses(&high_buckets, right_start, right_end, &ranked_clauses, final_sorted_clauses, &rank_key, &extracted, alloc);
+			extracted_count += right_end - right_start;
+		}
+		else {
+			p0--;
+			extract_ranked_clauses(&low_buckets, left_start, left_end, &ranked_clauses, final_sorted_clauses, &rank_key, &extracted, alloc);
+			extracted_count += left_end - left_start;
+		}
+	}
+
+	check_clauses(final_sorted_clauses, var_pos);
+	list_free(&extracted);
+	list_free(&fenwick);
+	list_free(&high_energy_sum);
+	list_free(&low_energy_sum);
+	list_free(&high_buckets);
+	list_free(&high_start);
+	list_free(&low_buckets);
+	list_free(&low_start);
+	list_free(&var_energy);
+	list_free(&rank_key);
+	list_free(&high_pos);
+	list_free(&low_pos);
+	list_free(&ranked_energy);
+	list_free(&ranked_clauses);
+	list_free(&energy_key);
+	list_free(&order);
+}
+
+/*
+ State of one optimize_instance worker. Each worker has its own allocator so workers never share memory,
+ and keeps the best layout among the restarts it ran.
+*/
+struct RestartWorker {
+	Allocator alloc;
+	List in_var_pos;
+	List out_var_pos;
+	List out_var_ring;
+	List out_instance;
+	List best_var_pos;
+	List best_var_ring;
+	List best_instance;
+	uint32 best_energy;
+	uint32 best_restart;
+	uint32 last_energy;
+	Profile profile; //of the restarts run on a thread of its own
+};
+
+/*
+ Limits on the restarts of optimize_instance_budgeted, 0 disables a limit (at least one must be set).
+ max_restarts: total number of restarts.
+ max_seconds: wall time, restarts already running when it runs out are completed.
+ max_restarts_without_improvement: stop once that many restarts in a row did not lower the best energy.
+*/
+struct OptimizeBudget {
+	uint32 max_restarts;
+	real64 max_seconds;
+	uint32 max_restarts_without_improvement;
+};
+
+struct OptimizeResult {
+	uint32 energy;
+	uint32 restarts; //restarts the best layout was chosen from
+	real64 seconds;
+};
+
+/*
+ Restarts are handed out in index order, and their energies are committed in index order, whatever the worker
+ that ran them. The stop rules only look at committed restarts, so the restarts the result is chosen from do not
+ depend on the thread count (except for max_seconds).
+*/
+struct RestartQueue {
+	List* instance;
+	ClauseBlock* block; //the clauses of instance, built once for the energy of every restart
+	uint32 n;
+	uint32 seed;
+	List* warm_var_pos;
+	OptimizeBudget budget;
+	std::chrono::steady_clock::time_point start_time;
+	std::mutex lock;
+	bool closed; //no more restarts are handed out
+	bool stopped; //no more restarts are committed
+	uint32 next_restart;
+	List restart_energy; //energy of every started restart, MAX_UINT32 while it is running
+	uint32 committed; //restarts [0, committed) are done
+	uint32 best_energy;
+	uint32 best_restart;
+};
+
+void restart_worker_init(RestartWorker* worker, uint32 n, uint32 m) {
+	//the lists of the worker and of optimize, and the hashes of the plateau states optimize visits
+	mem_index size = (1 << 18) + 16 * (mem_index)m * sizeof(Clause) + 32 * (mem_index)n * sizeof(uint32) + 96 * (mem_index)n * sizeof(uint64);
+	allocator_init(&worker->alloc, size, 1);
+	list_init(&worker->in_var_pos, &worker->alloc, sizeof(uint32), n, true);
+	list_init(&worker->out_var_pos, &worker->alloc, sizeof(uint32), n, true);
+	list_init(&worker->out_var_ring, &worker->alloc, sizeof(uint32), n, true);
+	list_init(&worker->out_instance, &worker->alloc, sizeof(Clause), m, false);
+	list_init(&worker->best_var_pos, &worker->alloc, sizeof(uint32), n, true);
+	list_init(&worker->best_var_ring, &worker->alloc, sizeof(uint32), n, true);
+	list_init(&worker->best_instance, &worker->alloc, sizeof(Clause), m, false);
+	worker->best_energy = MAX_UINT32;
+	worker->best_restart = MAX_UINT32;
+	profile_init(&worker->profile);
+}
+
+//forgets the restarts of the previous optimize_instance_budgeted call, keeping the lists
+void restart_worker_reset(RestartWorker* worker) {
+	worker->best_energy = MAX_UINT32;
+	worker->best_restart = MAX_UINT32;
+	profile_init(&worker->profile);
+}
+
+void restart_worker_free(RestartWorker* worker) {
+	allocator_free(&worker->alloc);
+}
+
+/*
+ Runs a single optimize restart from a shuffled layout.
+ With a warm_var_pos layout (a layout found for a similar instance), restart 0 starts from that layout and the
+ other restarts from that layout with 1 + n / 8 random position swaps, instead of a full shuffle.
+ The shuffle and the optimization only use a random stream derived from (seed, restart), so the
+ result of a restart does not depend on which worker runs it.
+*/
+void optimize_restart(RestartWorker* worker, List* instance, ClauseBlock* block, uint32 n, uint32 seed, uint32 restart, List* warm_var_pos) {
+
+	Rand rand;
+	rand_set_seed(&rand, rand_derive_seed(seed, restart));
+	PROFILE_COUNT(COUNTER_OPTIMIZE_RESTARTS, 1);
+
+	if (warm_var_pos != NULL) {
+		for (uint32 i = 0; i < n; i++) {
+			uint32 pos = list_read(warm_var_pos, i, uint32);
+			list_set(&worker->in_var_pos, i, &pos);
+		}
+		uint32 swap_count = restart == 0 ? 0 : 1 + n / 8;
+		for (uint32 k = 0; k < swap_count; k++) {
+			uint32 v0 = rand_next_int(&rand, n);
+			uint32 v1 = rand_next_int(&rand, n);
+			uint32 pos0 = list_read(&worker->in_var_pos, v0, uint32);
+			uint32 pos1 = list_read(&worker->in_var_pos, v1, uint32);
+			list_set(&worker->in_var_pos, v0, &pos1);
+			list_set(&worker->in_var_pos, v1, &pos0);
+		}
+	}
+	else {
+		for (uint32 i = 0; i < n; i++) {
+			list_set(&worker->in_var_pos, i, &i);
+		}
+
+		//shuffle the variable positions
+		for (uint32 i = 0; i < n; i++) {
+			int rng = n - i;
+			uint32 p = i + rand_next_int(&rand, rng);
+			uint32 var_p = list_read(&worker->in_var_pos, p, uint32);
+			uint32 var_i = list_read(&worker->in_var_pos, i, uint32);
+			list_set(&worker->in_var_pos, p, &var_i);
+			list_set(&worker->in_var_pos, i, &var_p);
+		}
+	}
+
+	TRACE_BEGIN("optimize restart", "restart", restart);
+	uint32 total_energy = optimize(instance, block, n, &worker->in_var_pos, &worker->out_var_pos, &worker->out_var_ring, &worker->out_instance, &rand, &worker->alloc);
+	worker->last_energy = total_energy;
+	TRACE_END("optimize restart");
+
+	//ties go to the lowest restart index so that the best layout does not depend on the thread count
+	if (total_energy < worker->best_energy || (total_energy == worker->best_energy && restart < worker->best_restart)) {
+		worker->best_energy = total_energy;
+		worker->best_restart = restart;
+		for (uint32 i = 0; i < n; i++) {
+			uint32 pos = list_read(&worker->out_var_pos, i, uint32);
+			uint32 var = list_read(&worker->out_var_ring, i, uint32);
+			list_set(&worker->best_var_pos, i, &pos);
+			list_set(&worker->best_var_ring, i, &var);
+		}
+		copy_clauses(&worker->out_instance, &worker->best_instance);
+	}
+}
+
+real64 seconds_since(std::chrono::steady_clock::time_point start_time) {
+	return std::chrono::duration<real64>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+void optimize_restarts_worker(RestartWorker* worker, RestartQueue* queue, bool own_thread) {
+	if (own_thread) {
+		PROFILE_SET(&worker->profile);
+	}
+	//the hardware counters of the calling thread are read by the optimize phase, those of the others here
+	PROFILE_HARDWARE(PHASE_OPTIMIZE, own_thread);
+	uint32 running = MAX_UINT32;
+	while (true) {
+		uint32 restart = 0;
+		{
+			std::lock_guard<std::mutex> guard(queue->lock);
+			OptimizeBudget* budget = &queue->budget;
+			if (budget->max_restarts > 0 && queue->next_restart >= budget->max_restarts) {
+				queue->closed = true;
+			}
+			//restart 0 is always run, so that there is a best layout even if the time is up before it starts
+			if (budget->max_seconds > 0 && queue->next_restart > 0 && seconds_since(queue->start_time) >= budget->max_seconds) {
+				queue->closed = true;
+			}
+			if (queue->closed) {
+				break;
+			}
+			restart = queue->next_restart++;
+			list_add(&queue->restart_energy, &running);
+		}
+
+		optimize_restart(worker, queue->instance, queue->block, queue->n, queue->seed, restart, queue->warm_var_pos);
+		uint32 energy = worker->last_energy;
+
+		{
+			std::lock_guard<std::mutex> guard(queue->lock);
+			list_set(&queue->restart_energy, restart, &energy);
+			//commit the restarts that are done, in order. The last restart to finish commits all the remaining ones.
+			while (!queue->stopped && queue->committed < queue->next_restart) {
+				uint32 e = list_read(&queue->restart_energy, queue->committed, uint32);
+				if (e == MAX_UINT32) {
+					break;
+				}
+				if (e < queue->best_energy) {
+					queue->best_energy = e;
+					queue->best_restart = queue->committed;
+				}
+				queue->committed++;
+				uint32 k = queue->budget.max_restarts_without_improvement;
+				if (k > 0 && queue->committed - 1 - queue->best_restart >= k) {
+					queue->stopped = true;
+					queue->closed = true;
+				}
+			}
+		}
+	}
+}
+
+/*
+ Restart workers kept from one optimize_instance_budgeted call to the next, with their arenas and threads. Worker 0
+ runs on the calling thread, and the others wait on threads of their own for the next restart queue. The arenas are
+ made for an instance size, and only made again for a larger instance (or another n): a sweep reserves its largest
+ m up front. A pool runs one call at a time.
+*/
+struct OptimizePool {
+	uint32 thread_count;
+	uint32 n; //instance size of the worker arenas, 0 before the first reserve
+	uint32 m;
+	RestartWorker* workers;
+	std::thread* threads;
+	std::mutex lock;
+	std::condition_variable start; //a new queue, or quit
+	std::condition_variable done; //the last worker thread left the queue
+	RestartQueue* queue;
+	uint64 generation; //incremented for every queue, so that each thread runs it once
+	uint32 running; //worker threads still on the queue
+	bool quit;
+};
+
+void optimize_pool_thread(OptimizePool* pool, uint32 t) {
+	uint64 generation = 0;
+	while (true) {
+		RestartQueue* queue = NULL;
+		{
+			std::unique_lock<std::mutex> guard(pool->lock);
+			while (!pool->quit && pool->generation == generation) {
+				pool->start.wait(guard);
+			}
+			if (pool->quit) break;
+			generation = pool->generation;
+			queue = pool->queue;
+		}
+		optimize_restarts_worker(&pool->workers[t], queue, true);
+		std::lock_guard<std::mutex> guard(pool->lock);
+		if (--pool->running == 0) {
+			pool->done.notify_one();
+		}
+	}
+}
+
+void optimize_pool_init(OptimizePool* pool, uint32 thread_count) {
+	pool->thread_count = thread_count < 1 ? 1 : thread_count;
+	pool->n = 0;
+	pool->m = 0;
+	pool->workers = (RestartWorker*)malloc(pool->thread_count * sizeof(RestartWorker));
+	pool->queue = NULL;
+	pool->generation = 0;
+	pool->running = 0;
+	pool->quit = false;
+	pool->threads = new std::thread[pool->thread_count];
+	for (uint32 t = 1; t < pool->thread_count; t++) {
+		pool->threads[t] = std::thread(optimize_pool_thread, pool, t);
+	}
+}
+
+void optimize_pool_free(OptimizePool* pool) {
+	{
+		std::lock_guard<std::mutex> guard(pool->lock);
+		pool->quit = true;
+		pool->start.notify_all();
+	}
+	for (uint32 t = 1; t < pool->thread_count; t++) {
+		pool->threads[t].join();
+	}
+	delete[] pool->threads;
+	if (pool->n > 0) {
+		for (uint32 t = 0; t < pool->thread_count; t++) {
+			restart_worker_free(&pool->workers[t]);
+		}
+	}
+	free(pool->workers);
+}
+
+/*
+ Makes the worker arenas fit instances of n vars and up to m clauses.
+*/
+void optimize_pool_reserve(OptimizePool* pool, uint32 n, uint32 m) {
+	if (pool->n == n && pool->m >= m) return;
+	for (uint32 t = 0; t < pool->thread_count; t++) {
+		if (pool->n > 0) {
+			restart_worker_free(&pool->workers[t]);
+		}
+		restart_worker_init(&pool->workers[t], n, m);
+	}
+	pool->n = n;
+	pool->m = m;
+}
+
+/*
+ The layout is a ring, and the solver needs it cut into a line. Cutting before position t, a clause at positions
+ a < b < c spans n - (b - a) if a < t <= b, n - (c - b) if b < t <= c, and c - a otherwise.
+ The total span of every cut point is swept with a difference array in O(n + m), and the lowest one is returned
+ (0, the current cut, on ties).
+*/
+uint32 ring_best_cut(List* triplets, List* var_pos, uint32 n, Allocator* alloc) {
+	List span_delta;
+	list_init(&span_delta, alloc, sizeof(int64), n + 1, true);
+	list_set_to_zero(&span_delta);
+	int64 base_span = 0;
+	for (uint32 i = 0; i < triplets->length; i++) {
+		Clause clause = list_read(triplets, i, Clause);
+		int64 a = list_read(var_pos, clause.i0, uint32);
+		int64 b = list_read(var_pos, clause.i1, uint32);
+		int64 c = list_read(var_pos, clause.i2, uint32);
+		base_span += c - a;
+		int64 d;
+		d = list_read(&span_delta, (uint32)a + 1, int64) + (n - (b - a)) - (c - a);
+		list_set(&span_delta, (uint32)a + 1, &d);
+		d = list_read(&span_delta, (uint32)b + 1, int64) - (n - (b - a)) + (n - (c - b));
+		list_set(&span_delta, (uint32)b + 1, &d);
+		d = list_read(&span_delta, (uint32)c + 1, int64) - (n - (c - b)) + (c - a);
+		list_set(&span_delta, (uint32)c + 1, &d);
+	}
+	uint32 best_cut = 0;
+	int64 best_span = base_span;
+	int64 span = base_span;
+	for (uint32 t = 1; t < n; t++) {
+		span += list_read(&span_delta, t, int64);
+		if (span < best_span) {
+			best_span = span;
+			best_cut = t;
+		}
+	}
+	list_free(&span_delta);
+	return best_cut;
+}
+
+/*
+ Rotates the layout so that position cut becomes position 0, and sorts the triplets by their new positions.
+*/
+void ring_rotate(List* var_pos, List* var_ring, List* triplets, uint32 n, uint32 cut) {
+	if (cut == 0) return;
+	for (uint32 v = 0; v < n; v++) {
+		uint32 pos = (list_read(var_pos, v, uint32) + n - cut) % n;
+		list_set(var_pos, v, &pos);
+		list_set(var_ring, pos, &v);
+	}
+	for (uint32 i = 0; i < triplets->length; i++) {
+		Clause triplet = triplet_sorted_by_pos(list_read(triplets, i, Clause), var_pos);
+		list_set(triplets, i, &triplet);
+	}
+}
+
+/*
+ Optimize a given instance by re-arranging the order of its variables and clauses, running optimize restarts
+ until the budget runs out. The restarts are spread over the workers of pool, the calling thread being one of them.
+ warm_var_pos (or NULL) is a layout to start from, typically the optimized layout of an instance it extends, so
+ that a few restarts are enough (see optimize_restart).
+ Returns the lowest energy, and the number of restarts the layout was chosen from.
+*/
+OptimizeResult optimize_instance_budgeted(List* instance, uint32 n, List* optimized_var_pos, List* optimized_var_ring, List* optimized_instance, uint32 seed, OptimizePool* pool, OptimizeBudget* budget, List* warm_var_pos, Allocator* alloc) {
+	PROFILE_SCOPE(PHASE_OPTIMIZE);
+
+	mem_index start_alloc_size = alloc->free_size;
+
+	assert(budget->max_restarts > 0 || budget->max_seconds > 0 || budget->max_restarts_without_improvement > 0, "optimize budget has no limit");
+	optimize_pool_reserve(pool, n, instance->length);
+	uint32 thread_count = pool->thread_count;
+	RestartWorker* workers = pool->workers;
+
+	ClauseBlock block;
+	clause_block_init(&block, instance, alloc);
+
+	RestartQueue queue;
+	queue.instance = instance;
+	queue.block = &block;
+	queue.n = n;
+	queue.seed = seed;
+	queue.warm_var_pos = warm_var_pos;
+	queue.budget = *budget;
+	queue.start_time = std::chrono::steady_clock::now();
+	queue.closed = false;
+	queue.stopped = false;
+	queue.next_restart = 0;
+	list_init(&queue.restart_energy, alloc, sizeof(uint32), budget->max_restarts > 0 ? budget->max_restarts : 128, false);
+	queue.committed = 0;
+	queue.best_energy = MAX_UINT32;
+	queue.best_restart = 0;
+
+	for (uint32 t = 0; t < thread_count; t++) {
+		restart_worker_reset(&workers[t]);
+	}
+	{
+		std::lock_guard<std::mutex> guard(pool->lock);
+		pool->queue = &queue;
+		pool->running = thread_count - 1;
+		pool->generation++;
+		pool->start.notify_all();
+	}
+	optimize_restarts_worker(&workers[0], &queue, false);
+	{
+		std::unique_lock<std::mutex> guard(pool->lock);
+		while (pool->running > 0) {
+			pool->done.wait(guard);
+		}
+		pool->queue = NULL;
+	}
+#if defined(THREE_SAT_PROFILE)
+	if (profile_current != NULL) {
+		for (uint32 t = 1; t < thread_count; t++) {
+			profile_merge(profile_current, &workers[t].profile);
+		}
+	}
+#endif
+
+	//the worker that ran the best restart keeps its layout, unless it later found a lower energy
+	//in a restart past the stop point, in which case the best restart is run again.
+	RestartWorker* best = NULL;
+	for (uint32 t = 0; t < thread_count; t++) {
+		if (workers[t].best_restart == queue.best_restart) {
+			best = &workers[t];
+		}
+	}
+	if (best == NULL) {
+		best = &workers[0];
+		best->best_energy = MAX_UINT32;
+		optimize_restart(best, instance, &block, n, seed, queue.best_restart, warm_var_pos);
+	}
+	assert(best->best_energy == queue.best_energy, "best restart energy mismatch");
+
+	OptimizeResult result;
+	result.energy = queue.best_energy;
+	result.restarts = queue.committed;
+
+	for (uint32 i = 0; i < n; i++) {
+		uint32 pos = list_read(&best->best_var_pos, i, uint32);
+		uint32 var = list_read(&best->best_var_ring, i, uint32);
+		list_set(optimized_var_pos, i, &pos);
+		list_set(optimized_var_ring, i, &var);
+	}
+	List lowest_energy_instance;
+	list_init(&lowest_energy_instance, alloc, sizeof(Clause), instance->length, false);
+	copy_clauses(&best->best_instance, &lowest_energy_instance);
+	check_clauses(&lowest_energy_instance, optimized_var_pos);
+	//cut the ring where the clauses span the least
+	uint32 cut = ring_best_cut(&lowest_energy_instance, optimized_var_pos, n, alloc);
+	ring_rotate(optimized_var_pos, optimized_var_ring, &lowest_energy_instance, n, cut);
+
+	list_free(&queue.restart_energy);
+	clause_block_free(&block);
+
+	prioritize_clauses(optimized_instance, optimized_var_pos, n, &lowest_energy_instance, alloc);
+
+	list_free(&lowest_energy_instance);
+
+	result.seconds = seconds_since(queue.start_time);
+
+	mem_index end_alloc_size = alloc->free_size;
+
+	assert(start_alloc_size == end_alloc_size, "");
+
+	return result;
+}
+
+/*
+ Optimize a given instance by re-arranging the order of its variables and clauses, with a fixed count of 100 restarts.
+ The workers only live for the call: repeated calls should keep an OptimizePool and use optimize_instance_budgeted.
+*/
+int optimize_instance(List* instance, uint32 n, List* optimized_var_pos, List* optimized_var_ring, List* optimized_instance, uint32 seed, uint32 thread_count, Allocator* alloc) {
+	OptimizeBudget budget;
+	budget.max_restarts = 100;
+	budget.max_seconds = 0;
+	budget.max_restarts_without_improvement = 0;
+	OptimizePool pool;
+	optimize_pool_init(&pool, thread_count);
+	OptimizeResult result = optimize_instance_budgeted(instance, n, optimized_var_pos, optimized_var_ring, optimized_instance, seed, &pool, &budget, NULL, alloc);
+	optimize_pool_free(&pool);
+	return result.energy;
+}
+
+/*
+ Fingerprint of the clause set of an instance, independent of the clause order and of the var order inside clauses:
+ the sum of a 64 bit hash of every clause, with its literals sorted by var.
+*/
+uint64 instance_fingerprint(List* instance, uint32 n) {
+	uint64 fingerprint = 0;
+	for (uint32 i = 0; i < instance->length; i++) {
+		Clause c = list_read(instance, i, Clause);
+		uint64 literals[3] = { (uint64)c.i0 * 2 + c.b0, (uint64)c.i1 * 2 + c.b1, (uint64)c.i2 * 2 + c.b2 };
+		for (uint32 a = 0; a < 2; a++) {
+			for (uint32 b = a + 1; b < 3; b++) {
+				if (literals[b] < literals[a]) {
+					uint64 t = literals[a];
+					literals[a] = literals[b];
+					literals[b] = t;
+				}
+			}
+		}
+		uint64 h = n;
+		for (uint32 k = 0; k < 3; k++) {
+			h = (uint64)rand_derive_seed((int64)h, literals[k]);
+		}
+		fingerprint += h;
+	}
+	return fingerprint;
+}
+
+/*
+ Key of an optimized ordering: the instance fingerprint, mixed with the optimize budget, so that the ordering found
+ with a few restarts is not served to a sweep with a larger budget.
+*/
+uint64 ordering_cache_key(List* instance, uint32 n, OptimizeBudget* budget) {
+	uint64 seconds;
+	memcpy(&seconds, &budget->max_seconds, sizeof(uint64));
+	uint64 key = instance_fingerprint(instance, n);
+	key = (uint64)rand_derive_seed((int64)key, budget->max_restarts);
+	key = (uint64)rand_derive_seed((int64)key, budget->max_restarts_without_improvement);
+	key = (uint64)rand_derive_seed((int64)key, seconds);
+	return key;
+}
+
+/*
+ Optimized orderings (var_pos, var_ring, prioritized clauses and energy) of instances of n vars, by ordering_cache_key.
+ The cache has its own allocator. With a file, the entries of the file are loaded, and new entries are appended to it,
+ so that the orderings are kept from one run to the next. A record cut short (by a crash while it was written) is
+ truncated from the file before appending.
+
+ File records: key (uint64), n, m, energy (uint32), var_pos and var_ring (n uint32 each), and the clauses
+ (i0, i1, i2 as uint32 then b0, b1, b2 as uint8). Records of other var counts are skipped.
+*/
+struct OrderingCache {
+	Allocator alloc;
+	uint32 n;
+	FILE* file;
+	List fingerprints; //uint64, one per entry
+	List energies; //uint32
+	List clause_start; //uint32, clauses of entry e are clauses[clause_start[e], clause_start[e + 1])
+	List var_pos; //n per entry
+	List var_ring; //n per entry
+	List clauses;
+	List slots; //open addressing table of entry index + 1, 0 for an empty slot
+	uint32 hit_count;
+	uint32 miss_count; //lookups of orderings that were not in the cache
+	uint32 full_count; //orderings not kept in memory because the cache allocator was near full
+	std::mutex lock; //taken by optimize_instance_cached, the cache is shared by the sweep workers
+};
+
+#define ORDERING_CACHE_MAGIC "3SATORD2"
+
+uint32 ordering_cache_find(OrderingCache* cache, uint64 fingerprint) {
+	uint32 slot_mask = cache->slots.length - 1;
+	uint32 slot = (uint32)(fingerprint ^ (fingerprint >> 32)) & slot_mask;
+	while (true) {
+		uint32 entry = list_read(&cache->slots, slot, uint32);
+		if (entry == 0) {
+			return MAX_UINT32;
+		}
+		if (list_read(&cache->fingerprints, entry - 1, uint64) == fingerprint) {
+			return entry - 1;
+		}
+		slot = (slot + 1) & slot_mask;
+	}
+}
+
+void ordering_cache_index(OrderingCache* cache, uint32 entry) {
+	uint64 fingerprint = list_read(&cache->fingerprints, entry, uint64);
+	uint32 slot_mask = cache->slots.length - 1;
+	uint32 slot = (uint32)(fingerprint ^ (fingerprint >> 32)) & slot_mask;
+	while (list_read(&cache->slots, slot, uint32) != 0) {
+		slot = (slot + 1) & slot_mask;
+	}
+	uint32 value = entry + 1;
+	list_set(&cache->slots, slot, &value);
+}
+
+/*
+ Whether an entry of clause_count clauses fits in the cache allocator. Half of the free space is kept as a margin,
+ because the free space of the allocator is not in one piece.
+*/
+bool ordering_cache_has_room(OrderingCache* cache, uint32 clause_count) {
+	mem_index needed = list_grow_size(&cache->fingerprints, 1) + list_grow_size(&cache->energies, 1) + list_grow_size(&cache->clause_start, 1);
+	needed += list_grow_size(&cache->var_pos, cache->n) + list_grow_size(&cache->var_ring, cache->n) + list_grow_size(&cache->clauses, clause_count);
+	if (2 * (cache->fingerprints.length + 1) > cache->slots.length) {
+		needed += 2 * cache->slots.size * sizeof(uint32) + cache->alloc.SEGMENT_HEADER_SIZE;
+	}
+	return 2 * needed <= cache->alloc.free_size;
+}
+
+/*
+ Adds an entry in memory, and to the cache file if persist is set. An entry already in the cache is not added again.
+ When the cache allocator is near full, the entry is still written to the file, but not kept in memory.
+*/
+void ordering_cache_add(OrderingCache* cache, uint64 fingerprint, uint32 energy, List* var_pos, List* var_ring, List* clauses, bool persist) {
+	if (ordering_cache_find(cache, fingerprint) != MAX_UINT32) return;
+	if (persist && cache->file != NULL) {
+		uint32 header[3] = { cache->n, clauses->length, energy };
+		fwrite(&fingerprint, sizeof(uint64), 1, cache->file);
+		fwrite(header, sizeof(uint32), 3, cache->file);
+		fwrite(var_pos->alloc->address + var_pos->index, sizeof(uint32), cache->n, cache->file);
+		fwrite(var_ring->alloc->address + var_ring->index, sizeof(uint32), cache->n, cache->file);
+		for (uint32 i = 0; i < clauses->length; i++) {
+			Clause c = list_read(clauses, i, Clause);
+			uint32 vars[3] = { c.i0, c.i1, c.i2 };
+			uint8 signs[3] = { c.b0, c.b1, c.b2 };
+			fwrite(vars, sizeof(uint32), 3, cache->file);
+			fwrite(signs, sizeof(uint8), 3, cache->file);
+		}
+		fflush(cache->file);
+	}
+	if (!ordering_cache_has_room(cache, clauses->length)) {
+		cache->full_count++;
+		return;
+	}
+	uint32 entry = cache->fingerprints.length;
+	list_add(&cache->fingerprints, &fingerprint);
+	list_add(&cache->energies, &energy);
+	for (uint32 i = 0; i < cache->n; i++) {
+		uint32 pos = list_read(var_pos, i, uint32);
+		uint32 var = list_read(var_ring, i, uint32);
+		list_add(&cache->var_pos, &pos);
+		list_add(&cache->var_ring, &var);
+	}
+	for (uint32 i = 0; i < clauses->length; i++) {
+		Clause c = list_read(clauses, i, Clause);
+		list_add(&cache->clauses, &c);
+	}
+	uint32 clause_end = cache->clauses.length;
+	list_add(&cache->clause_start, &clause_end);
+
+	if (2 * cache->fingerprints.length > cache->slots.length) {
+		//grow the table and reindex every entry
+		list_free(&cache->slots);
+		list_init(&cache->slots, &cache->alloc, sizeof(uint32), 2 * cache->slots.size, true);
+		list_set_to_zero(&cache->slots);
+		for (uint32 e = 0; e < cache->fingerprints.length; e++) {
+			ordering_cache_index(cache, e);
+		}
+	}
+	else {
+		ordering_cache_index(cache, entry);
+	}
+}
+
+/*
+ path can be NULL for a cache that only lives in memory. size is the size of the cache allocator: once it is near
+ full, new orderings are no longer kept in memory (they are still written to the file).
+*/
+void ordering_cache_init(OrderingCache* cache, uint32 n, char* path, mem_index size) {
+	allocator_init(&cache->alloc, size, 2);
+	cache->n = n;
+	cache->file = NULL;
+	cache->hit_count = 0;
+	cache->miss_count = 0;
+	cache->full_count = 0;
+	list_init(&cache->fingerprints, &cache->alloc, sizeof(uint64), 64, false);
+	list_init(&cache->energies, &cache->alloc, sizeof(uint32), 64, false);
+	list_init(&cache->clause_start, &cache->alloc, sizeof(uint32), 64, false);
+	uint32 zero = 0;
+	list_add(&cache->clause_start, &zero);
+	list_init(&cache->var_pos, &cache->alloc, sizeof(uint32), 64 * n, false);
+	list_init(&cache->var_ring, &cache->alloc, sizeof(uint32), 64 * n, false);
+	list_init(&cache->clauses, &cache->alloc, sizeof(Clause), 64 * n, false);
+	list_init(&cache->slots, &cache->alloc, sizeof(uint32), 128, true);
+	list_set_to_zero(&cache->slots);
+	if (path == NULL) return;
+
+	List var_pos;
+	list_init(&var_pos, &cache->alloc, sizeof(uint32), n, true);
+	List var_ring;
+	list_init(&var_ring, &cache->alloc, sizeof(uint32), n, true);
+	List clauses;
+	list_init(&clauses, &cache->alloc, sizeof(Clause), 64, false);
+	List skipped;
+	list_init(&skipped, &cache->alloc, sizeof(uint32), 64, false);
+
+	FILE* file = fopen(path, "rb");
+	bool valid = false;
+	long complete_end = 0; //end of the last complete record
+	if (file != NULL) {
+		char magic[8];
+		valid = fread(magic, 1, 8, file) == 8 && memcmp(magic, ORDERING_CACHE_MAGIC, 8) == 0;
+		complete_end = ftell(file);
+		while (valid) {
+			uint64 fingerprint;
+			uint32 header[3];
+			if (fread(&fingerprint, sizeof(uint64), 1, file) != 1 || fread(header, sizeof(uint32), 3, file) != 3) break;
+			uint32 record_n = header[0];
+			uint32 record_m = header[1];
+			bool same_n = record_n == n;
+			List* pos_list = same_n ? &var_pos : &skipped;
+			List* ring_list = same_n ? &var_ring : &skipped;
+			if (!same_n) {
+				list_clear(&skipped);
+				for (uint32 i = 0; i < record_n; i++) list_add(&skipped, &zero);
+			}
+			if (fread(pos_list->alloc->address + pos_list->index, sizeof(uint32), record_n, file) != record_n) break;
+			if (fread(ring_list->alloc->address + ring_list->index, sizeof(uint32), record_n, file) != record_n) break;
+			list_clear(&clauses);
+			bool complete = true;
+			for (uint32 i = 0; i < record_m; i++) {
+				uint32 vars[3];
+				uint8 signs[3];
+				if (fread(vars, sizeof(uint32), 3, file) != 3 || fread(signs, sizeof(uint8), 3, file) != 3) {
+					complete = false;
+					break;
+				}
+				Clause c = { vars[0], vars[1], vars[2], signs[0] != 0, signs[1] != 0, signs[2] != 0 };
+				list_add(&clauses, &c);
+			}
+			if (!complete) break;
+			if (same_n) {
+				ordering_cache_add(cache, fingerprint, header[2], &var_pos, &var_ring, &clauses, false);
+			}
+			complete_end = ftell(file);
+		}
+		fclose(file);
+	}
+
+	list_free(&skipped);
+	list_free(&clauses);
+	list_free(&var_ring);
+	list_free(&var_pos);
+
+	if (valid) {
+		cache->file = fopen(path, "r+b");
+		if (cache->file != NULL) {
+			//drop a record cut short, so that the new records follow the complete ones
+#if defined(_WIN32)
+			bool truncated = _chsize_s(_fileno(cache->file), complete_end) == 0;
+#else
+			bool truncated = ftruncate(fileno(cache->file), complete_end) == 0;
+#endif
+			assert(truncated && fseek(cache->file, 0, SEEK_END) == 0, "cannot truncate the ordering cache file");
+		}
+	}
+	else {
+		//new (or unreadable) cache file
+		cache->file = fopen(path, "wb");
+		if (cache->file != NULL) {
+			fwrite(ORDERING_CACHE_MAGIC, 1, 8, cache->file);
+		}
+	}
+	assert(cache->file != NULL, "cannot open the ordering cache file");
+}
+
+void ordering_cache_free(OrderingCache* cache) {
+	if (cache->file != NULL) {
+		fclose(cache->file);
+		cache->file = NULL;
+	}
+	allocator_free(&cache->alloc);
+}
+
+/*
+ optimize_instance_budgeted, through an ordering cache (or not, when cache is NULL). A cached instance is not optimized
+ again: its layout and clause order are read from the cache, and no restart is counted.
+*/
+OptimizeResult optimize_instance_cached(OrderingCache* cache, List* instance, uint32 n, List* optimized_var_pos, List* optimized_var_ring, List* optimized_instance, uint32 seed, OptimizePool* pool, OptimizeBudget* budget, List* warm_var_pos, Allocator* alloc) {
+	if (cache == NULL) {
+		return optimize_instance_budgeted(instance, n, optimized_var_pos, optimized_var_ring, optimized_instance, seed, pool, budget, warm_var_pos, alloc);
+	}
+	assert(cache->n == n, "ordering cache var count mismatch");
+	uint64 key = ordering_cache_key(instance, n, budget);
+	OptimizeResult result;
+	{
+		std::lock_guard<std::mutex> guard(cache->lock);
+		uint32 entry = ordering_cache_find(cache, key);
+		if (entry != MAX_UINT32) {
+			cache->hit_count++;
+			for (uint32 i = 0; i < n; i++) {
+				uint32 pos = list_read(&cache->var_pos, entry * n + i, uint32);
+				uint32 var = list_read(&cache->var_ring, entry * n + i, uint32);
+				list_set(optimized_var_pos, i, &pos);
+				list_set(optimized_var_ring, i, &var);
+			}
+			list_clear(optimized_instance);
+			uint32 clause_end = list_read(&cache->clause_start, entry + 1, uint32);
+			for (uint32 i = list_read(&cache->clause_start, entry, uint32); i < clause_end; i++) {
+				Clause c = list_read(&cache->clauses, i, Clause);
+				list_add(optimized_instance, &c);
+			}
+			result.energy = list_read(&cache->energies, entry, uint32);
+			result.restarts = 0;
+			result.seconds = 0;
+			return result;
+		}
+		cache->miss_count++;
+	}
+	result = optimize_instance_budgeted(instance, n, optimized_var_pos, optimized_var_ring, optimized_instance, seed, pool, budget, warm_var_pos, alloc);
+	std::lock_guard<std::mutex> guard(cache->lock);
+	ordering_cache_add(cache, key, result.energy, optimized_var_pos, optimized_var_ring, optimized_instance, true);
+	return result;
+}
+
+/*
+ Variable interaction graph: vars are connected when they share a clause, the edge weight being the count of shared clauses.
+ The neighbours of v are adjacency[adjacency_start[v] .. adjacency_start[v + 1]] in increasing var order.
+*/
+struct VarGraph {
+	uint32 n;
+	List adjacency_start;
+	List adjacency;
+	List weight;
+	List degree; //sum of the edge weights of each var
+};
+
+void var_graph_init(VarGraph* g, List* instance, uint32 n, Allocator* alloc) {
+	g->n = n;
+	uint32 m = instance->length;
+	//every clause gives 6 directed edges, which we bucket by source var
+	List edge_start;
+	list_init(&edge_start, alloc, sizeof(uint32), n + 1, true);
+	list_set_to_zero(&edge_start);
+	for (uint32 i = 0; i < m; i++) {
+		Clause c = list_read(instance, i, Clause);
+		uint32 vars[3] = { c.i0, c.i1, c.i2 };
+		for (uint32 k = 0; k < 3; k++) {
+			uint32 count = list_read(&edge_start, vars[k] + 1, uint32) + 2;
+			list_set(&edge_start, vars[k] + 1, &count);
+		}
+	}
+	for (uint32 v = 0; v < n; v++) {
+		uint32 start = list_read(&edge_start, v, uint32) + list_read(&edge_start, v + 1, uint32);
+		list_set(&edge_start, v + 1, &start);
+	}
+	uint32 edge_count = list_read(&edge_start, n, uint32);
+	List edges;
+	list_init(&edges, alloc, sizeof(uint32), edge_count > 0 ? edge_count : 1, true);
+	List fill;
+	list_init(&fill, alloc, sizeof(uint32), n, true);
+	for (uint32 v = 0; v < n; v++) {
+		uint32 start = list_read(&edge_start, v, uint32);
+		list_set(&fill, v, &start);
+	}
+	for (uint32 i = 0; i < m; i++) {
+		Clause c = list_read(instance, i, Clause);
+		uint32 vars[3] = { c.i0, c.i1, c.i2 };
+		for (uint32 k = 0; k < 3; k++) {
+			uint32 slot = list_read(&fill, vars[k], uint32);
+			list_set(&edges, slot++, &vars[(k + 1) % 3]);
+			list_set(&edges, slot++, &vars[(k + 2) % 3]);
+			list_set(&fill, vars[k], &slot);
+		}
+	}
+
+	//merge the duplicate edges of every var, counting them in a per var weight scratch
+	list_init(&g->adjacency_start, alloc, sizeof(uint32), n + 1, true);
+	list_init(&g->adjacency, alloc, sizeof(uint32), edge_count > 0 ? edge_count : 1, false);
+	list_init(&g->weight, alloc, sizeof(uint32), edge_count > 0 ? edge_count : 1, false);
+	list_init(&g->degree, alloc, sizeof(uint32), n, true);
+	List scratch;
+	list_init(&scratch, alloc, sizeof(uint32), n, true);
+	list_set_to_zero(&scratch);
+	List var_key;
+	list_init(&var_key, alloc, sizeof(real64), n, true);
+	for (uint32 v = 0; v < n; v++) {
+		real64 key = (real64)v;
+		list_set(&var_key, v, &key);
+	}
+	List neighbours;
+	list_init(&neighbours, alloc, sizeof(uint32), 16, false);
+	for (uint32 v = 0; v < n; v++) {
+		uint32 start = list_read(&edge_start, v, uint32);
+		uint32 end = list_read(&edge_start, v + 1, uint32);
+		list_clear(&neighbours);
+		for (uint32 k = start; k < end; k++) {
+			uint32 u = list_read(&edges, k, uint32);
+			if (u == v) continue; //vars merged by coarsening
+			uint32 w = list_read(&scratch, u, uint32) + 1;
+			if (w == 1) list_add(&neighbours, &u);
+			list_set(&scratch, u, &w);
+		}
+		sort_indices(&neighbours, &var_key, alloc);
+		uint32 adjacency_start = g->adjacency.length;
+		list_set(&g->adjacency_start, v, &adjacency_start);
+		uint32 degree = 0;
+		for (uint32 k = 0; k < neighbours.length; k++) {
+			uint32 u = list_read(&neighbours, k, uint32);
+			uint32 w = list_read(&scratch, u, uint32);
+			list_add(&g->adjacency, &u);
+			list_add(&g->weight, &w);
+			degree += w;
+			uint32 zero = 0;
+			list_set(&scratch, u, &zero);
+		}
+		list_set(&g->degree, v, &degree);
+	}
+	uint32 adjacency_end = g->adjacency.length;
+	list_set(&g->adjacency_start, n, &adjacency_end);
+
+	list_free(&neighbours);
+	list_free(&var_key);
+	list_free(&scratch);
+	list_free(&fill);
+	list_free(&edges);
+	list_free(&edge_start);
+}
+
+void var_graph_free(VarGraph* g) {
+	list_free(&g->degree);
+	list_free(&g->weight);
+	list_free(&g->adjacency);
+	list_free(&g->adjacency_start);
+}
+
+/*
+ Breadth first search over the unvisited vars of the component of start.
+ Returns the var of the last level with the lowest degree, and its level in eccentricity.
+*/
+uint32 var_graph_farthest(VarGraph* g, uint32 start, List* visited, List* level, List* queue, uint32* eccentricity) {
+	list_clear(queue);
+	list_add(queue, &start);
+	uint32 zero = 0;
+	list_set(level, start, &zero);
+	uint32 marker = 2;
+	list_set(visited, start, &marker);
+	uint32 farthest = start;
+	uint32 farthest_level = 0;
+	for (uint32 head = 0; head < queue->length; head++) {
+		uint32 v = list_read(queue, head, uint32);
+		uint32 l = list_read(level, v, uint32);
+		if (l > farthest_level || (l == farthest_level && list_read(&g->degree, v, uint32) < list_read(&g->degree, farthest, uint32))) {
+			farthest = v;
+			farthest_level = l;
+		}
+		uint32 start_k = list_read(&g->adjacency_start, v, uint32);
+		uint32 end_k = list_read(&g->adjacency_start, v + 1, uint32);
+		for (uint32 k = start_k; k < end_k; k++) {
+			uint32 u = list_read(&g->adjacency, k, uint32);
+			if (list_read(visited, u, uint32) != 0) continue;
+			list_set(visited, u, &marker);
+			uint32 lu = l + 1;
+			list_set(level, u, &lu);
+			list_add(queue, &u);
+		}
+	}
+	//unmark the component
+	for (uint32 i = 0; i < queue->length; i++) {
+		list_set(visited, list_read(queue, i, uint32), &zero);
+	}
+	*eccentricity = farthest_level;
+	return farthest;
+}
+
+/*
+ Reverse Cuthill-McKee ordering of the vars: breadth first search from a pseudo peripheral var of each component,
+ visiting the neighbours of every var by increasing degree, then reversed. Keeps vars that share clauses close.
+ order receives the vars, in order.
+*/
+void rcm_order(VarGraph* g, List* order, Allocator* alloc) {
+	uint32 n = g->n;
+	List visited;
+	list_init(&visited, alloc, sizeof(uint32), n, true);
+	list_set_to_zero(&visited);
+	List level;
+	list_init(&level, alloc, sizeof(uint32), n, true);
+	List queue;
+	list_init(&queue, alloc, sizeof(uint32), n, false);
+	List neighbours;
+	list_init(&neighbours, alloc, sizeof(uint32), n, false);
+	List degree_key;
+	list_init(&degree_key, alloc, sizeof(real64), n, true);
+	for (uint32 v = 0; v < n; v++) {
+		real64 d = (real64)list_read(&g->degree, v, uint32);
+		list_set(&degree_key, v, &d);
+	}
+
+	list_clear(order);
+	uint32 one = 1;
+	while (order->length < n) {
+		//start from the unvisited var of lowest degree, and move to a pseudo peripheral var of its component
+		uint32 start = MAX_UINT32;
+		for (uint32 v = 0; v < n; v++) {
+			if (list_read(&visited, v, uint32) != 0) continue;
+			if (start == MAX_UINT32 || list_read(&g->degree, v, uint32) < list_read(&g->degree, start, uint32)) {
+				start = v;
+			}
+		}
+		uint32 eccentricity = 0;
+		uint32 farthest = var_graph_farthest(g, start, &visited, &level, &queue, &eccentricity);
+		for (uint32 iteration = 0; iteration < 5; iteration++) {
+			uint32 next_eccentricity = 0;
+			uint32 next = var_graph_farthest(g, farthest, &visited, &level, &queue, &next_eccentricity);
+			if (next_eccentricity <= eccentricity) break;
+			start = farthest;
+			farthest = next;
+			eccentricity = next_eccentricity;
+		}
+		start = farthest;
+
+		uint32 head = order->length;
+		list_add(order, &start);
+		list_set(&visited, start, &one);
+		while (head < order->length) {
+			uint32 v = list_read(order, head++, uint32);
+			list_clear(&neighbours);
+			uint32 start_k = list_read(&g->adjacency_start, v, uint32);
+			uint32 end_k = list_read(&g->adjacency_start, v + 1, uint32);
+			for (uint32 k = start_k; k < end_k; k++) {
+				uint32 u = list_read(&g->adjacency, k, uint32);
+				if (list_read(&visited, u, uint32) != 0) continue;
+				list_set(&visited, u, &one);
+				list_add(&neighbours, &u);
+			}
+			sort_indices(&neighbours, &degree_key, alloc);
+			for (uint32 k = 0; k < neighbours.length; k++) {
+				uint32 u = list_read(&neighbours, k, uint32);
+				list_add(order, &u);
+			}
+		}
+	}
+
+	//reverse
+	for (uint32 i = 0; i < n / 2; i++) {
+		uint32 a = list_read(order, i, uint32);
+		uint32 b = list_read(order, n - 1 - i, uint32);
+		list_set(order, i, &b);
+		list_set(order, n - 1 - i, &a);
+	}
+
+	list_free(&degree_key);
+	list_free(&neighbours);
+	list_free(&queue);
+	list_free(&level);
+	list_free(&visited);
+}
+
+/*
+ y = (L + shift.I) x, with L = D - W the laplacian of the var graph.
+*/
+void var_graph_laplacian_multiply(VarGraph* g, List* x, List* y, real64 shift) {
+	for (uint32 v = 0; v < g->n; v++) {
+		real64 yv = (list_read(&g->degree, v, uint32) + shift) * list_read(x, v, real64);
+		uint32 start_k = list_read(&g->adjacency_start, v, uint32);
+		uint32 end_k = list_read(&g->adjacency_start, v + 1, uint32);
+		for (uint32 k = start_k; k < end_k; k++) {
+			yv -= list_read(&g->weight, k, uint32) * list_read(x, list_read(&g->adjacency, k, uint32), real64);
+		}
+		list_set(y, v, &yv);
+	}
+}
+
+real64 vector_dot(List* a, List* b) {
+	real64 dot = 0;
+	for (uint32 i = 0; i < a->length; i++) dot += list_read(a, i, real64) * list_read(b, i, real64);
+	return dot;
+}
+
+void vector_copy(List* from, List* to) {
+	for (uint32 i = 0; i < from->length; i++) {
+		real64 v = list_read(from, i, real64);
+		list_set(to, i, &v);
+	}
+}
+
+//a = a + scale.b
+void vector_add_scaled(List* a, List* b, real64 scale) {
+	for (uint32 i = 0; i < a->length; i++) {
+		real64 v = list_read(a, i, real64) + scale * list_read(b, i, real64);
+		list_set(a, i, &v);
+	}
+}
+
+//projects out the constant vector and normalizes, returns false for a constant vector
+bool vector_center_normalize(List* x) {
+	uint32 n = x->length;
+	real64 mean = 0;
+	for (uint32 v = 0; v < n; v++) mean += list_read(x, v, real64);
+	mean /= n;
+	real64 norm = 0;
+	for (uint32 v = 0; v < n; v++) {
+		real64 xv = list_read(x, v, real64) - mean;
+		list_set(x, v, &xv);
+		norm += xv * xv;
+	}
+	norm = sqrt(norm);
+	if (norm == 0) return false;
+	for (uint32 v = 0; v < n; v++) {
+		real64 xv = list_read(x, v, real64) / norm;
+		list_set(x, v, &xv);
+	}
+	return true;
+}
+
+#define SPECTRAL_MAX_ITERATIONS 64
+#define SPECTRAL_MAX_CG_ITERATIONS 500
+#define SPECTRAL_TOLERANCE 1e-9 //on the residual, relative to the largest eigenvalue bound
+#define SPECTRAL_SHIFT 1e-9 //relative to the largest eigenvalue bound, keeps L + shift.I definite on disconnected graphs
+
+/*
+ Fiedler vector of the var graph laplacian L = D - W (the eigenvector of its second smallest eigenvalue), by inverse
+ iteration: x is replaced by the solution of (L + shift.I) y = x, found by conjugate gradient, with the constant
+ vector projected out. Each step divides the error by about lambda_3 / lambda_2, where power iteration on c.I - L only
+ divides it by (c - lambda_3) / (c - lambda_2), which is close to 1 on sparse graphs.
+ x holds the start vector (n values) and receives the normalized vector. Iterates until the residual
+ ||L x - lambda x|| is below SPECTRAL_TOLERANCE.c, or for SPECTRAL_MAX_ITERATIONS steps (each of at most
+ SPECTRAL_MAX_CG_ITERATIONS passes of O(m)). Returns the residual.
+*/
+real64 fiedler_vector(VarGraph* g, List* x, Allocator* alloc) {
+	uint32 n = g->n;
+	//c bounds the largest eigenvalue of L
+	real64 c = 0;
+	for (uint32 v = 0; v < n; v++) {
+		real64 d = 2.0 * list_read(&g->degree, v, uint32);
+		if (d > c) c = d;
+	}
+	if (c == 0) c = 1;
+	if (!vector_center_normalize(x)) return 0;
+
+	List y;
+	list_init(&y, alloc, sizeof(real64), n, true);
+	List r;
+	list_init(&r, alloc, sizeof(real64), n, true);
+	List p;
+	list_init(&p, alloc, sizeof(real64), n, true);
+	List q;
+	list_init(&q, alloc, sizeof(real64), n, true);
+	real64 shift = SPECTRAL_SHIFT * c;
+	real64 residual = 0;
+	for (uint32 iteration = 0; ; iteration++) {
+		//residual of the current estimate, with lambda its Rayleigh quotient
+		var_graph_laplacian_multiply(g, x, &q, 0);
+		real64 lambda = vector_dot(x, &q);
+		vector_add_scaled(&q, x, -lambda);
+		residual = sqrt(vector_dot(&q, &q));
+		if (residual <= SPECTRAL_TOLERANCE * c || iteration == SPECTRAL_MAX_ITERATIONS) break;
+
+		//conjugate gradient on (L + shift.I) y = x, from y = 0; every iterate stays orthogonal to the constant vector
+		list_set_to_zero(&y);
+		vector_copy(x, &r);
+		vector_copy(x, &p);
+		real64 rr = vector_dot(&r, &r);
+		for (uint32 k = 0; k < SPECTRAL_MAX_CG_ITERATIONS && rr > 1e-24; k++) {
+			var_graph_laplacian_multiply(g, &p, &q, shift);
+			real64 alpha = rr / vector_dot(&p, &q);
+			vector_add_scaled(&y, &p, alpha);
+			vector_add_scaled(&r, &q, -alpha);
+			real64 next_rr = vector_dot(&r, &r);
+			for (uint32 v = 0; v < n; v++) {
+				real64 pv = list_read(&r, v, real64) + next_rr / rr * list_read(&p, v, real64);
+				list_set(&p, v, &pv);
+			}
+			rr = next_rr;
+		}
+		vector_copy(&y, x);
+		if (!vector_center_normalize(x)) break;
+	}
+
+	list_free(&q);
+	list_free(&p);
+	list_free(&r);
+	list_free(&y);
+	return residual;
+}
+
+/*
+ Spectral ordering: vars sorted by their value in the Fiedler vector of the graph laplacian, which places strongly
+ connected vars next to each other. The vector is found by fiedler_vector, starting from the rcm positions.
+*/
+void spectral_order(VarGraph* g, List* order, Allocator* alloc) {
+	uint32 n = g->n;
+	rcm_order(g, order, alloc);
+	if (n < 3) return;
+
+	List x;
+	list_init(&x, alloc, sizeof(real64), n, true);
+	for (uint32 p = 0; p < n; p++) {
+		real64 v = (real64)p;
+		list_set(&x, list_read(order, p, uint32), &v);
+	}
+	fiedler_vector(g, &x, alloc);
+
+	for (uint32 v = 0; v < n; v++) {
+		list_set(order, v, &v);
+	}
+	sort_indices(order, &x, alloc);
+
+	list_free(&x);
+}
+
+enum OrderingMethod {
+	ORDERING_OPTIMIZE, //optimize restarts (optimize_instance_budgeted)
+	ORDERING_RCM, //reverse Cuthill-McKee
+	ORDERING_SPECTRAL, //Fiedler vector
+	ORDERING_MULTILEVEL, //coarsened and refined, for large n
+};
+
+/*
+ Energy of a clause in a linear layout: the same as clause_energy of the clause sorted by position, but also defined
+ for clauses whose vars were merged together by coarsening.
+*/
+int32 clause_span_energy(Clause clause, List* var_pos) {
+	uint32 pos0 = list_read(var_pos, clause.i0, uint32);
+	uint32 pos1 = list_read(var_pos, clause.i1, uint32);
+	uint32 pos2 = list_read(var_pos, clause.i2, uint32);
+	uint32 lowest = pos0 < pos1 ? (pos0 < pos2 ? pos0 : pos2) : (pos1 < pos2 ? pos1 : pos2);
+	uint32 highest = pos0 > pos1 ? (pos0 > pos2 ? pos0 : pos2) : (pos1 > pos2 ? pos1 : pos2);
+	return 4 * (int32)(highest - lowest);
+}
+
+/*
+ Improves a linear ordering by swapping neighbouring vars while it lowers the total clause energy.
+ A pass costs O(m), and the number of passes is bounded, so that it scales with the instance size.
+*/
+void refine_linear_order(List* instance, uint32 n, List* order, Allocator* alloc) {
+	uint32 m = instance->length;
+
+	//clauses of every var
+	List var_clause_start;
+	list_init(&var_clause_start, alloc, sizeof(uint32), n + 1, true);
+	list_set_to_zero(&var_clause_start);
+	for (uint32 i = 0; i < m; i++) {
+		Clause c = list_read(instance, i, Clause);
+		uint32 vars[3] = { c.i0, c.i1, c.i2 };
+		for (uint32 k = 0; k < 3; k++) {
+			if ((k > 0 && vars[k] == vars[0]) || (k > 1 && vars[k] == vars[1])) continue;
+			uint32 count = list_read(&var_clause_start, vars[k] + 1, uint32) + 1;
+			list_set(&var_clause_start, vars[k] + 1, &count);
+		}
+	}
+	for (uint32 v = 0; v < n; v++) {
+		uint32 start = list_read(&var_clause_start, v, uint32) + list_read(&var_clause_start, v + 1, uint32);
+		list_set(&var_clause_start, v + 1, &start);
+	}
+	uint32 entry_count = list_read(&var_clause_start, n, uint32);
+	List var_clauses;
+	list_init(&var_clauses, alloc, sizeof(uint32), entry_count > 0 ? entry_count : 1, true);
+	List fill;
+	list_init(&fill, alloc, sizeof(uint32), n, true);
+	for (uint32 v = 0; v < n; v++) {
+		uint32 start = list_read(&var_clause_start, v, uint32);
+		list_set(&fill, v, &start);
+	}
+	for (uint32 i = 0; i < m; i++) {
+		Clause c = list_read(instance, i, Clause);
+		uint32 vars[3] = { c.i0, c.i1, c.i2 };
+		for (uint32 k = 0; k < 3; k++) {
+			if ((k > 0 && vars[k] == vars[0]) || (k > 1 && vars[k] == vars[1])) continue;
+			uint32 slot = list_read(&fill, vars[k], uint32);
+			list_set(&var_clauses, slot, &i);
+			slot++;
+			list_set(&fill, vars[k], &slot);
+		}
+	}
+
+	List var_pos;
+	list_init(&var_pos, alloc, sizeof(uint32), n, true);
+	for (uint32 p = 0; p < n; p++) {
+		list_set(&var_pos, list_read(order, p, uint32), &p);
+	}
+
+	for (uint32 pass = 0; pass < 16; pass++) {
+		uint32 swap_count = 0;
+		for (uint32 p = 0; p + 1 < n; p++) {
+			uint32 u = list_read(order, p, uint32);
+			uint32 v = list_read(order, p + 1, uint32);
+			//the clauses holding both u and v keep their span, counting them twice does not change the delta
+			int32 energy_before = 0;
+			int32 energy_after = 0;
+			uint32 swapped_vars[2] = { u, v };
+			for (uint32 side = 0; side < 2; side++) {
+				uint32 w = swapped_vars[side];
+				uint32 start = list_read(&var_clause_start, w, uint32);
+				uint32 end = list_read(&var_clause_start, w + 1, uint32);
+				for (uint32 k = start; k < end; k++) {
+					energy_before += clause_span_energy(list_read(instance, list_read(&var_clauses, k, uint32), Clause), &var_pos);
+				}
+			}
+			uint32 pu = p + 1;
+			uint32 pv = p;
+			list_set(&var_pos, u, &pu);
+			list_set(&var_pos, v, &pv);
+			for (uint32 side = 0; side < 2; side++) {
+				uint32 w = swapped_vars[side];
+				uint32 start = list_read(&var_clause_start, w, uint32);
+				uint32 end = list_read(&var_clause_start, w + 1, uint32);
+				for (uint32 k = start; k < end; k++) {
+					energy_after += clause_span_energy(list_read(instance, list_read(&var_clauses, k, uint32), Clause), &var_pos);
+				}
+			}
+			if (energy_after < energy_before) {
+				list_set(order, p, &v);
+				list_set(order, p + 1, &u);
+				swap_count++;
+			}
+			else {
+				list_set(&var_pos, u, &pv);
+				list_set(&var_pos, v, &pu);
+			}
+		}
+		PROFILE_COUNT(COUNTER_SWAPS, swap_count);
+		if (swap_count == 0) break;
+	}
+
+	list_free(&var_pos);
+	list_free(&fill);
+	list_free(&var_clauses);
+	list_free(&var_clause_start);
+}
+
+/*
+ Multilevel ordering: vars are matched with the var they share the most clauses with, merged, and the coarser instance
+ is ordered recursively (spectral order once it is small). Matched vars are then put next to each other and the
+ ordering is refined at every level. Each level costs O(m), and the var count about halves at every level.
+*/
+void multilevel_order(List* instance, uint32 n, List* order, Allocator* alloc) {
+	VarGraph g;
+	var_graph_init(&g, instance, n, alloc);
+	if (n <= 16) {
+		spectral_order(&g, order, alloc);
+		var_graph_free(&g);
+		return;
+	}
+
+	//heavy edge matching, visiting vars by increasing degree
+	List visit;
+	list_init(&visit, alloc, sizeof(uint32), n, true);
+	List degree_key;
+	list_init(&degree_key, alloc, sizeof(real64), n, true);
+	for (uint32 v = 0; v < n; v++) {
+		list_set(&visit, v, &v);
+		real64 d = (real64)list_read(&g.degree, v, uint32);
+		list_set(&degree_key, v, &d);
+	}
+	sort_indices(&visit, &degree_key, alloc);
+
+	List coarse_var;
+	list_init(&coarse_var, alloc, sizeof(uint32), n, true);
+	for (uint32 v = 0; v < n; v++) {
+		uint32 unmatched = MAX_UINT32;
+		list_set(&coarse_var, v, &unmatched);
+	}
+	uint32 coarse_n = 0;
+	for (uint32 i = 0; i < n; i++) {
+		uint32 v = list_read(&visit, i, uint32);
+		if (list_read(&coarse_var, v, uint32) != MAX_UINT32) continue;
+		uint32 mate = MAX_UINT32;
+		uint32 mate_weight = 0;
+		uint32 start = list_read(&g.adjacency_start, v, uint32);
+		uint32 end = list_read(&g.adjacency_start, v + 1, uint32);
+		for (uint32 k = start; k < end; k++) {
+			uint32 u = list_read(&g.adjacency, k, uint32);
+			uint32 w = list_read(&g.weight, k, uint32);
+			if (list_read(&coarse_var, u, uint32) == MAX_UINT32 && w > mate_weight) {
+				mate = u;
+				mate_weight = w;
+			}
+		}
+		list_set(&coarse_var, v, &coarse_n);
+		if (mate != MAX_UINT32) {
+			list_set(&coarse_var, mate, &coarse_n);
+		}
+		coarse_n++;
+	}
+	var_graph_free(&g);
+	list_free(&degree_key);
+	list_free(&visit);
+
+	if (coarse_n * 10 > n * 9) {
+		//not enough vars share clauses to coarsen
+		VarGraph flat;
+		var_graph_init(&flat, instance, n, alloc);
+		spectral_order(&flat, order, alloc);
+		var_graph_free(&flat);
+	}
+	else {
+		//clauses over the coarse vars, without the ones merged into a single var
+		List coarse_instance;
+		list_init(&coarse_instance, alloc, sizeof(Clause), instance->length > 0 ? instance->length : 1, false);
+		for (uint32 i = 0; i < instance->length; i++) {
+			Clause c = list_read(instance, i, Clause);
+			c.i0 = list_read(&coarse_var, c.i0, uint32);
+			c.i1 = list_read(&coarse_var, c.i1, uint32);
+			c.i2 = list_read(&coarse_var, c.i2, uint32);
+			if (c.i0 == c.i1 && c.i1 == c.i2) continue;
+			list_add(&coarse_instance, &c);
+		}
+		List coarse_order;
+		list_init(&coarse_order, alloc, sizeof(uint32), coarse_n, false);
+		multilevel_order(&coarse_instance, coarse_n, &coarse_order, alloc);
+
+		//expand every coarse var into its vars
+		List coarse_pos;
+		list_init(&coarse_pos, alloc, sizeof(uint32), coarse_n, true);
+		for (uint32 p = 0; p < coarse_n; p++) {
+			list_set(&coarse_pos, list_read(&coarse_order, p, uint32), &p);
+		}
+		List pos_key;
+		list_init(&pos_key, alloc, sizeof(real64), n, true);
+		list_clear(order);
+		for (uint32 v = 0; v < n; v++) {
+			real64 key = (real64)list_read(&coarse_pos, list_read(&coarse_var, v, uint32), uint32);
+			list_set(&pos_key, v, &key);
+			list_add(order, &v);
+		}
+		sort_indices(order, &pos_key, alloc);
+		refine_linear_order(instance, n, order, alloc);
+
+		list_free(&pos_key);
+		list_free(&coarse_pos);
+		list_free(&coarse_order);
+		list_free(&coarse_instance);
+	}
+	list_free(&coarse_var);
+}
+
+/*
+ Orders the vars of an instance with a graph ordering (ORDERING_RCM, ORDERING_SPECTRAL or ORDERING_MULTILEVEL) instead of optimize restarts,
+ which is deterministic and much cheaper than a batch of restarts. Outputs are the same as optimize_instance.
+ With refine, optimize runs once from that ordering and its layout is kept if it has a lower energy.
+*/
+uint32 order_instance(List* instance, uint32 n, OrderingMethod method, bool refine, List* optimized_var_pos, List* optimized_var_ring, List* optimized_instance, uint32 seed, Allocator* alloc) {
+	PROFILE_SCOPE(PHASE_ORDER);
+
+	mem_index start_alloc_size = alloc->free_size;
+
+	List order;
+	list_init(&order, alloc, sizeof(uint32), n, false);
+	if (method == ORDERING_MULTILEVEL) {
+		multilevel_order(instance, n, &order, alloc);
+	}
+	else {
+		VarGraph g;
+		var_graph_init(&g, instance, n, alloc);
+		if (method == ORDERING_SPECTRAL) {
+			spectral_order(&g, &order, alloc);
+		}
+		else {
+			rcm_order(&g, &order, alloc);
+		}
+		var_graph_free(&g);
+	}
+
+	for (uint32 p = 0; p < n; p++) {
+		uint32 v = list_read(&order, p, uint32);
+		list_set(optimized_var_ring, p, &v);
+		list_set(optimized_var_pos, v, &p);
+	}
+	list_free(&order);
+
+	List triplets;
+	list_init(&triplets, alloc, sizeof(Clause), instance->length, false);
+	for (uint32 i = 0; i < instance->length; i++) {
+		Clause triplet = triplet_sorted_by_pos(list_read(instance, i, Clause), optimized_var_pos);
+		list_add(&triplets, &triplet);
+	}
+	ClauseBlock block;
+	clause_block_init(&block, instance, alloc);
+	uint32 energy = clause_block_energy(&block, optimized_var_pos);
+
+	if (refine) {
+		RestartWorker worker;
+		restart_worker_init(&worker, n, instance->length);
+		Rand rand;
+		rand_set_seed(&rand, seed);
+		uint32 refined_energy = optimize(instance, &block, n, optimized_var_pos, &worker.out_var_pos, &worker.out_var_ring, &worker.out_instance, &rand, &worker.alloc);
+		if (refined_energy < energy) {
+			energy = refined_energy;
+			for (uint32 i = 0; i < n; i++) {
+				uint32 pos = list_read(&worker.out_var_pos, i, uint32);
+				uint32 var = list_read(&worker.out_var_ring, i, uint32);
+				list_set(optimized_var_pos, i, &pos);
+				list_set(optimized_var_ring, i, &var);
+			}
+			copy_clauses(&worker.out_instance, &triplets);
+		}
+		restart_worker_free(&worker);
+	}
+	clause_block_free(&block);
+
+	prioritize_clauses(optimized_instance, optimized_var_pos, n, &triplets, alloc);
+	list_free(&triplets);
+
+	mem_index end_alloc_size = alloc->free_size;
+	assert(start_alloc_size == end_alloc_size, "");
+
+	return energy;
+}
+
+void transform_solution(List* in_solution, List* out_solution, List* out_var_ring, uint32 n) {
+	for (uint32 i = 0; i < n; i++) {
+		bool v = list_read(in_solution, i, bool);
+		uint32 pos = list_read(out_var_ring, i, uint32);
+		list_set(out_solution, pos, &v);
+	}
+}
+
+/*
+ Swap variable order.
+*/
+void transform_instance(List* var_pos, List* var_ring, uint32 n, List* clauses, List* transformed_clauses) {
+	PROFILE_SCOPE(PHASE_TRANSFORM);
+
+	//example
+	//var pos:  3, 2, 4, 1, 0, 12, 9, 13, 5, 10, 15, 14, 6, 7, 11, 8
+	//var ring: 4, 3, 1, 0, 2, 8, 12, 13, 15, 6, 9, 14, 5, 7, 11, 10
+	//clauses:
+	//[-2,-9,+10, -0,+12,+15, +2,-8,-15, -15,+6,-11, +13,+6,+9, -8,-13,-9,...
+
+	list_clear(transformed_clauses);
+	
+	for(uint32 i = 0; i < clauses->length; i++) {
+		Clause clause = list_read(clauses, i, Clause);
+		uint32 v0 = list_read(var_pos, clause.i0, uint32);
+		uint32 v1 = list_read(var_pos, clause.i1, uint32);
+		uint32 v2 = list_read(var_pos, clause.i2, uint32);
+		clause.i0 = v0;
+		clause.i1 = v1;
+		clause.i2 = v2;
+		list_add(transformed_clauses, &clause);
+	}
+}
+
+bool test_solution(List* instance, List* solution, uint32 n, bool verbose) {
+	PROFILE_SCOPE(PHASE_TEST_SOLUTION);
+	
+	if (verbose) {
+		
+		printf("\nSolution = ");
+		list_print_bool(solution);
+	}
+	for (uint32 i = 0; i < instance->length; i++) {
+		Clause c = list_read(instance, i , Clause);
+		bool b0 = list_read(solution, c.i0, bool);
+		bool b1 = list_read(solution, c.i1, bool);
+		bool b2 = list_read(solution, c.i2, bool);
+		bool s = clause_is_satisfied(&c, b0, b1, b2);
+
+		if (!s) {
+			char buffer[100];
+			sprintf_s(buffer, "SOLUTION FAILING: clause (%d,%d,%d) failed for values %d,%d,%d \n", (c.b0? c.i0: -1*c.i0), (c.b1 ? c.i1 : -1*c.i1), (c.b2 ? c.i2 : -1*c.i2), b0, b1, b2);
+			printf(buffer);
+			assert(s, buffer);
+			return false;
+		}
+	}
+	if (verbose) printf("SOLUTION PASSES!\n");
+	return true;
+}
+
+void shuffle_instance_and_check_size(List* instance, List* min_size_instance, List* max_size_instance, List* min_sizes, List* max_sizes, int n, bool shuffle, uint32 shuffle_count, Rand* rand, Allocator* alloc) {
 
 	uint32 length = instance->length;
 	uint32 count = 0;
@@ -3019,276 +5273,1773 @@ void shuffle_instance_and_check_size(List* instance, List* min_size_instance, Li
 	mem_index min_max_tree_size = 10000000;
 	mem_index avg_max_tree_size = 0;
 
-	if (!shuffle) {
-		shuffle_count = 1;
+	if (!shuffle) {
+		shuffle_count = 1;
+	}
+
+	List tree_sizes;
+	list_init(&tree_sizes, alloc, sizeof(mem_index), 100, false);
+	List volume_sizes;
+	list_init(&volume_sizes, alloc, sizeof(real64), 100, false);
+	List solution;
+	list_init(&solution, alloc, sizeof(bool), n, true);
+
+	Buffer tree;
+	buffer_init(&tree, 500000);
+
+	while (count++ < shuffle_count) {
+
+		//shuffle the clauses
+		if (shuffle) {
+			for (uint32 i = 0; i < length; i++) {
+				int rng = length - i;
+				int j = i + rand_next_int(rand, rng); //j is between between [i, length - 1]
+				//if j != j, swap element i with element i+j
+				if (i != j) {
+					Clause ci = list_read(instance, i, Clause);
+					Clause cj = list_read(instance, j, Clause);
+					list_set(instance, i, &cj);
+					list_set(instance, j, &ci);
+				}
+			}
+		}
+
+		list_clear(&tree_sizes);
+		list_clear(&volume_sizes);
+
+		buffer_reset(&tree);
+		list_clear(&tree_sizes);
+		bool solution_exists = solve_tree_instance_with_tree_size(instance, n, &tree_sizes, &tree, &solution, alloc);
+
+		//scan for maximum
+		mem_index max_size = 0;
+		for (uint32 i = 0; i < tree_sizes.length; i++) {
+			mem_index size = list_read(&tree_sizes, i, mem_index);
+			if (size > max_size) {
+				max_size = size;
+			}
+		}
+		avg_max_tree_size += max_size;
+
+		if (max_max_tree_size < max_size) {
+			max_max_tree_size = max_size;
+			list_clear(max_size_instance);
+			list_clear(max_sizes);
+			for (uint32 i = 0; i < instance->length; i++) {
+				Clause c = list_read(instance, i, Clause);
+				list_add(max_size_instance, &c);
+				mem_index s = list_read(&tree_sizes, i, mem_index);
+				list_add(max_sizes, &s);
+			}
+		}
+
+		if (max_size < min_max_tree_size) {
+			min_max_tree_size = max_size;
+			list_clear(min_size_instance);
+			list_clear(min_sizes);
+			for (uint32 i = 0; i < instance->length; i++) {
+				Clause c = list_read(instance, i, Clause);
+				list_add(min_size_instance, &c);
+				mem_index s = list_read(&tree_sizes, i, mem_index);
+				list_add(min_sizes, &s);
+			}
+		}
+
+		if (solution_exists) {
+			bool works = test_solution(instance, &solution, n, false);
+			assert(works, "failed solution!");
+		}
+		printf("max max tree size: %zu\n" + max_max_tree_size);
+		printf("min max tree size: %zu\n" + min_max_tree_size);
+	}
+
+	avg_max_tree_size = avg_max_tree_size / shuffle_count;
+
+	printf("avg max tree size: %zu" + avg_max_tree_size);
+
+	printf("max sizes: \n");
+	list_print_mem_index(max_sizes);
+	printf("min sizes: \n");
+	list_print_mem_index(min_sizes);
+
+	buffer_free(&tree);
+}
+
+/*
+ Count, mean, variance (Welford) and range of a stream of samples, in constant memory.
+*/
+struct RunningStats {
+	uint64 count;
+	real64 mean;
+	real64 m2; //sum of the squared differences to the mean
+	real64 min;
+	real64 max;
+};
+
+void running_stats_init(RunningStats* stats) {
+	stats->count = 0;
+	stats->mean = 0;
+	stats->m2 = 0;
+	stats->min = 0;
+	stats->max = 0;
+}
+
+void running_stats_add(RunningStats* stats, real64 x) {
+	if (stats->count == 0 || x < stats->min) stats->min = x;
+	if (stats->count == 0 || x > stats->max) stats->max = x;
+	stats->count++;
+	real64 delta = x - stats->mean;
+	stats->mean += delta / stats->count;
+	stats->m2 += delta * (x - stats->mean);
+}
+
+//combines the stats of two streams (Chan et al.)
+void running_stats_merge(RunningStats* stats, RunningStats* other) {
+	if (other->count == 0) return;
+	if (stats->count == 0) {
+		*stats = *other;
+		return;
+	}
+	uint64 count = stats->count + other->count;
+	real64 delta = other->mean - stats->mean;
+	stats->mean += delta * (real64)other->count / (real64)count;
+	stats->m2 += other->m2 + delta * delta * (real64)stats->count * (real64)other->count / (real64)count;
+	if (other->min < stats->min) stats->min = other->min;
+	if (other->max > stats->max) stats->max = other->max;
+	stats->count = count;
+}
+
+//population variance
+real64 running_stats_variance(RunningStats* stats) {
+	return stats->count == 0 ? 0 : stats->m2 / stats->count;
+}
+
+/*
+ 95% Wilson score interval of a proportion, after successes out of count trials.
+ Unlike the normal approximation, it does not shrink to a point when the proportion is 0 or 1.
+*/
+void proportion_interval(uint32 successes, uint32 count, real64* low, real64* high) {
+	if (count == 0) {
+		*low = 0;
+		*high = 1;
+		return;
+	}
+	real64 z = 1.96;
+	real64 n = (real64)count;
+	real64 p = (real64)successes / n;
+	real64 center = (p + z * z / (2 * n)) / (1 + z * z / n);
+	real64 half_width = z * sqrt(p * (1 - p) / n + z * z / (4 * n * n)) / (1 + z * z / n);
+	*low = center - half_width;
+	*high = center + half_width;
+}
+
+real64 proportion_interval_width(uint32 successes, uint32 count) {
+	real64 low;
+	real64 high;
+	proportion_interval(successes, count, &low, &high);
+	return high - low;
+}
+
+/*
+ Histogram of uint64 values in fixed memory, with buckets that grow with the values (HDR style): every power of 2
+ is split into LOG_HISTOGRAM_SUB_COUNT buckets, so a bucket is within 1/LOG_HISTOGRAM_SUB_COUNT of its values.
+ Histograms of the same values on different threads add up with log_histogram_merge.
+*/
+#define LOG_HISTOGRAM_SUB_BITS 4
+#define LOG_HISTOGRAM_SUB_COUNT (1 << LOG_HISTOGRAM_SUB_BITS)
+#define LOG_HISTOGRAM_BUCKET_COUNT ((64 - LOG_HISTOGRAM_SUB_BITS + 1) * LOG_HISTOGRAM_SUB_COUNT)
+
+struct LogHistogram {
+	uint64 total;
+	uint64 max;
+	uint64 counts[LOG_HISTOGRAM_BUCKET_COUNT];
+};
+
+void log_histogram_init(LogHistogram* histogram) {
+	memset(histogram, 0, sizeof(LogHistogram));
+}
+
+uint32 log_histogram_bucket(uint64 value) {
+	if (value < LOG_HISTOGRAM_SUB_COUNT) return (uint32)value;
+	uint32 e = LOG_HISTOGRAM_SUB_BITS;
+	while (e < 63 && (value >> (e + 1)) != 0) e++;
+	uint32 sub = (uint32)(value >> (e - LOG_HISTOGRAM_SUB_BITS)) & (LOG_HISTOGRAM_SUB_COUNT - 1);
+	return (e - LOG_HISTOGRAM_SUB_BITS + 1) * LOG_HISTOGRAM_SUB_COUNT + sub;
+}
+
+//smallest value of a bucket
+uint64 log_histogram_bucket_low(uint32 bucket) {
+	if (bucket < LOG_HISTOGRAM_SUB_COUNT) return bucket;
+	uint32 e = bucket / LOG_HISTOGRAM_SUB_COUNT + LOG_HISTOGRAM_SUB_BITS - 1;
+	uint64 sub = bucket % LOG_HISTOGRAM_SUB_COUNT;
+	return (LOG_HISTOGRAM_SUB_COUNT + sub) << (e - LOG_HISTOGRAM_SUB_BITS);
+}
+
+//largest value of a bucket
+uint64 log_histogram_bucket_high(uint32 bucket) {
+	if (bucket < LOG_HISTOGRAM_SUB_COUNT) return bucket;
+	uint32 e = bucket / LOG_HISTOGRAM_SUB_COUNT + LOG_HISTOGRAM_SUB_BITS - 1;
+	return log_histogram_bucket_low(bucket) + (((uint64)1 << (e - LOG_HISTOGRAM_SUB_BITS)) - 1);
+}
+
+void log_histogram_add(LogHistogram* histogram, uint64 value) {
+	histogram->counts[log_histogram_bucket(value)]++;
+	histogram->total++;
+	if (value > histogram->max) histogram->max = value;
+}
+
+void log_histogram_merge(LogHistogram* histogram, LogHistogram* other) {
+	for (uint32 b = 0; b < LOG_HISTOGRAM_BUCKET_COUNT; b++) {
+		histogram->counts[b] += other->counts[b];
+	}
+	histogram->total += other->total;
+	if (other->max > histogram->max) histogram->max = other->max;
+}
+
+/*
+ Value under which are percentile% of the values, rounded up to the end of its bucket.
+*/
+uint64 log_histogram_percentile(LogHistogram* histogram, real64 percentile) {
+	if (histogram->total == 0) return 0;
+	uint64 rank = (uint64)ceil(percentile / 100.0 * (real64)histogram->total);
+	if (rank < 1) rank = 1;
+	uint64 count = 0;
+	for (uint32 b = 0; b < LOG_HISTOGRAM_BUCKET_COUNT; b++) {
+		count += histogram->counts[b];
+		if (count >= rank) {
+			uint64 high = log_histogram_bucket_high(b);
+			return high < histogram->max ? high : histogram->max;
+		}
+	}
+	return histogram->max;
+}
+
+/*
+ Prints the non empty buckets, as smallest value:count.
+*/
+void log_histogram_print(LogHistogram* histogram, const char* name) {
+	printf("%s histogram:", name);
+	for (uint32 b = 0; b < LOG_HISTOGRAM_BUCKET_COUNT; b++) {
+		if (histogram->counts[b] != 0) {
+			printf(" %llu:%llu", (unsigned long long)log_histogram_bucket_low(b), (unsigned long long)histogram->counts[b]);
+		}
+	}
+	printf("\n");
+}
+
+void log_histogram_print_percentiles(LogHistogram* histogram, const char* name) {
+	printf("%s p50: %llu\n", name, (unsigned long long)log_histogram_percentile(histogram, 50));
+	printf("%s p99: %llu\n", name, (unsigned long long)log_histogram_percentile(histogram, 99));
+	printf("%s p99.9: %llu\n", name, (unsigned long long)log_histogram_percentile(histogram, 99.9));
+}
+
+enum PipelineStage {
+	STAGE_GENERATE,
+	STAGE_ORDER,
+	STAGE_SOLVE, //transform_instance and solve_tree_instance_with_tree_size
+	STAGE_VERIFY, //test_solution, and the result
+	PIPELINE_STAGE_COUNT,
+};
+
+/*
+ Settings of compute_transition_stats.
+*/
+struct SweepConfig {
+	uint32 sweep_thread_count; //workers running the (m, test) instances
+	uint32 thread_count; //workers running the optimize restarts of every instance
+	OptimizeBudget optimize_budget; //restarts spent on the ordering of every instance
+	OrderingMethod ordering; //how the vars of every instance are ordered before solving
+	bool refine_ordering; //run optimize once from the RCM or spectral ordering
+	bool nested_instances; //the instance at m + m_inc is the instance at m with m_inc more clauses
+	bool warm_start; //optimize from the layout of the same test at the previous m, needs nested_instances
+	uint32 warm_restarts; //perturbed restarts after the warm one
+	OrderingCache* ordering_cache; //orderings of the instances already optimized, or NULL
+	uint32 pipeline_threads[PIPELINE_STAGE_COUNT]; //workers of the generate, order, solve and verify stages, all 0 for no pipeline
+	uint32 pipeline_queue_size; //instances waiting between two stages
+	char* checkpoint_path; //file where the finished instances are saved, or NULL
+	real64 checkpoint_seconds; //time between two checkpoints
+	bool resume; //skip the instances already in the checkpoint file
+	char* trace_path; //with THREE_SAT_PROFILE, if not NULL, a Chrome trace of the sweep is written there
+	uint32 trace_events_per_thread; //the last events kept for every thread
+	List* max_tree_sizes; //if not NULL, gets the max tree size (mem_index) of every instance, in (m, test) order
+	bool clause_tree_sizes; //also report the tree size after every clause, over all the instances of an m
+	bool print_histograms; //print the tree size histograms, not only their percentiles
+	uint32 shard_index; //runs only the tasks of shard shard_index out of shard_count
+	uint32 shard_count; //0 or 1 for every task
+	char* results_path; //if not NULL, the summary of every m is written there, for merge_sweep_results
+	real64 adaptive_width; //if not 0, stop testing an m once the 95% interval of P(SAT) is narrower, with a budget of test_count tests per m
+	uint32 adaptive_batch; //tests added at once to an m that is not settled
+	uint32 adaptive_max_factor; //an m whose interval still contains 0.5 gets up to adaptive_max_factor * test_count tests
+};
+
+void sweep_config_init(SweepConfig* config) {
+	config->sweep_thread_count = 1;
+	config->thread_count = 1;
+	config->optimize_budget.max_restarts = 100;
+	config->optimize_budget.max_seconds = 0;
+	config->optimize_budget.max_restarts_without_improvement = 0;
+	config->ordering = ORDERING_OPTIMIZE;
+	config->refine_ordering = false;
+	config->nested_instances = false;
+	config->warm_start = false;
+	config->warm_restarts = 4;
+	config->ordering_cache = NULL;
+	for (uint32 s = 0; s < PIPELINE_STAGE_COUNT; s++) {
+		config->pipeline_threads[s] = 0;
+	}
+	config->pipeline_queue_size = 4;
+	config->checkpoint_path = NULL;
+	config->checkpoint_seconds = 60;
+	config->resume = false;
+	config->trace_path = NULL;
+	config->trace_events_per_thread = 1 << 16;
+	config->max_tree_sizes = NULL;
+	config->clause_tree_sizes = false;
+	config->print_histograms = false;
+	config->shard_index = 0;
+	config->shard_count = 1;
+	config->results_path = NULL;
+	config->adaptive_width = 0;
+	config->adaptive_batch = 32;
+	config->adaptive_max_factor = 4;
+}
+
+/*
+ Outcome of one (m, test) instance of a sweep.
+*/
+struct SweepTaskResult {
+	bool done;
+	bool solution_exists;
+	mem_index max_tree_size;
+	uint32 restarts;
+};
+
+/*
+ One instance going through the sweep stages, with its own allocator so that whichever thread holds it can use it.
+*/
+struct SweepInstance {
+	Allocator alloc;
+	uint32 m_index;
+	uint32 test;
+	List random_instance;
+	List optimized_instance;
+	List transformed_instance;
+	List in_var_pos;
+	List out_var_pos;
+	List out_var_ring;
+	List solution;
+	List out_solution;
+	List tree_sizes;
+	SweepTaskResult result;
+	Profile profile; //of the stages of the instance, reset by sweep_generate
+};
+
+/*
+ Tasks [begin, end) owned by a sweep worker. The owner takes tasks from the end, and idle workers steal half of the
+ remaining tasks from the beginning.
+*/
+struct TaskRange {
+	std::mutex lock;
+	uint32 begin;
+	uint32 end;
+};
+
+/*
+ State of one compute_transition_stats worker: its instance (allocator and lists), tree buffer and optimize workers.
+*/
+struct SweepWorker {
+	SweepInstance instance;
+	Buffer tree;
+	OptimizePool optimize_pool;
+	TaskRange tasks;
+};
+
+/*
+ State of one pipeline worker: the tree buffer of a solve worker, the optimize workers of an order worker.
+*/
+struct StageWorker {
+	PipelineStage stage;
+	Buffer tree;
+	OptimizePool optimize_pool;
+};
+
+/*
+ Bounded queue of instance handles (indices in the instance pool) between two pipeline stages.
+ Pushing blocks while the queue is full, and popping while it is empty and not closed.
+*/
+struct HandleQueue {
+	std::mutex lock;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+	List slots;
+	uint32 head;
+	uint32 count;
+	bool closed;
+};
+
+void handle_queue_init(HandleQueue* q, uint32 capacity, Allocator* alloc) {
+	list_init(&q->slots, alloc, sizeof(uint32), capacity, true);
+	q->head = 0;
+	q->count = 0;
+	q->closed = false;
+}
+
+void handle_queue_free(HandleQueue* q) {
+	list_free(&q->slots);
+}
+
+void handle_queue_push(HandleQueue* q, uint32 handle) {
+	std::unique_lock<std::mutex> guard(q->lock);
+	while (q->count == q->slots.length) {
+		q->not_full.wait(guard);
+	}
+	uint32 slot = (q->head + q->count) % q->slots.length;
+	list_set(&q->slots, slot, &handle);
+	q->count++;
+	q->not_empty.notify_one();
+}
+
+//returns false once the queue is closed and empty
+bool handle_queue_pop(HandleQueue* q, uint32* handle) {
+	std::unique_lock<std::mutex> guard(q->lock);
+	while (q->count == 0 && !q->closed) {
+		q->not_empty.wait(guard);
+	}
+	if (q->count == 0) {
+		return false;
+	}
+	*handle = list_read(&q->slots, q->head, uint32);
+	q->head = (q->head + 1) % q->slots.length;
+	q->count--;
+	q->not_full.notify_one();
+	return true;
+}
+
+void handle_queue_close(HandleQueue* q) {
+	std::lock_guard<std::mutex> guard(q->lock);
+	q->closed = true;
+	q->not_empty.notify_all();
+}
+
+//opens an empty closed queue again, for the next run of the pipeline
+void handle_queue_reopen(HandleQueue* q) {
+	std::lock_guard<std::mutex> guard(q->lock);
+	assert(q->count == 0, "reopened queue is not empty");
+	q->head = 0;
+	q->closed = false;
+}
+
+struct SweepContext {
+	uint32 n;
+	uint32 m_start;
+	uint32 m_inc;
+	uint32 m_count; //values of m
+	uint32 test_count;
+	SweepConfig* config;
+	bool test_sol;
+	bool chained; //a task is a test over every m (nested instances), instead of a single (m, test)
+	uint32 task_count;
+	List* task_slots; //if not NULL, the (m, test) slot of every task, instead of all of them in order (not chained)
+	List results; //SweepTaskResult of (m index, test) at m_index * test_count + test, each written by a single task
+	std::mutex results_lock; //taken to write a result, and to save the results in the checkpoint
+	LogHistogram* clause_histograms; //tree sizes after every clause, for every m (with config->clause_tree_sizes)
+	Profile* profiles; //of the instances of every m, filled with THREE_SAT_PROFILE
+	std::chrono::steady_clock::time_point checkpoint_time;
+	std::atomic<uint32> instances_done;
+	std::thread::id progress_thread; //the thread that runs the sweep, the only one printing the progress
+	uint32 instances_printed; //instances_done at the last progress line
+
+	//threads of the task pool or of the pipeline, besides the calling one: started by the first run, they wait for
+	//the next one, so that the batches of sweep_run_adaptive and find_threshold do not start threads
+	uint32 thread_count;
+	std::thread* threads;
+	std::mutex threads_lock;
+	std::condition_variable run_start; //a new run, or quit
+	std::condition_variable run_done; //the last thread finished the run
+	uint64 run_generation; //incremented for every run, so that each thread runs it once
+	uint32 threads_running; //threads still in the run
+	bool threads_quit;
+
+	//task pool, allocated by the first sweep_run_tasks and kept for the next runs
+	uint32 worker_capacity;
+	uint32 worker_count; //workers of the current run
+	SweepWorker* workers;
+
+	//pipeline: the instances circulate from the pool (free handles) through the stage queues and back.
+	//allocated by the first sweep_run_pipeline and kept for the next runs.
+	uint32 pool_size;
+	SweepInstance* pool;
+	uint32 stage_worker_count;
+	StageWorker* stage_workers;
+	HandleQueue free_handles;
+	HandleQueue stage_queues[PIPELINE_STAGE_COUNT]; //input of every stage but the first
+	std::atomic<uint32> next_task;
+	std::atomic<uint32> stage_running[PIPELINE_STAGE_COUNT];
+};
+
+void sweep_instance_init(SweepInstance* instance, uint32 n, uint32 m_end, Allocator* alloc) {
+	//every instance gets an allocator like the one of the caller
+	allocator_init(&instance->alloc, alloc->TOTAL_SIZE, alloc->SEGMENT_HEADER_SIZE);
+	list_init(&instance->random_instance, &instance->alloc, sizeof(Clause), m_end, false);
+	list_init(&instance->optimized_instance, &instance->alloc, sizeof(Clause), m_end, false);
+	list_init(&instance->transformed_instance, &instance->alloc, sizeof(Clause), m_end, false);
+	list_init(&instance->in_var_pos, &instance->alloc, sizeof(uint32), n, true);
+	list_init(&instance->out_var_pos, &instance->alloc, sizeof(uint32), n, true);
+	list_init(&instance->out_var_ring, &instance->alloc, sizeof(uint32), n, true);
+	list_init(&instance->solution, &instance->alloc, sizeof(bool), n, true);
+	list_init(&instance->out_solution, &instance->alloc, sizeof(bool), n, true);
+	list_init(&instance->tree_sizes, &instance->alloc, sizeof(mem_index), 100, false);
+}
+
+void sweep_instance_free(SweepInstance* instance) {
+	allocator_free(&instance->alloc);
+}
+
+/*
+ Instances only depend on (m, test): a single (m, test) instance uses the random stream of its index, and a chain of
+ nested instances (chain_rand) uses the stream of its test. So the results do not depend on the worker count.
+ Without a chain (chain_rand is NULL, as in the pipeline), every instance is a single one.
+*/
+void sweep_generate(SweepContext* context, SweepInstance* instance, Rand* chain_rand) {
+	profile_init(&instance->profile);
+	PROFILE_SET(&instance->profile);
+	uint32 m1 = context->m_start + instance->m_index * context->m_inc;
+	if (context->config->nested_instances && chain_rand != NULL) {
+		extend_random_instance(&instance->random_instance, context->n, m1, chain_rand);
+	}
+	else {
+		Rand r;
+		rand_set_seed(&r, rand_derive_seed(1, (uint64)instance->m_index * context->test_count + instance->test));
+		generate_random_instance(&instance->random_instance, context->n, m1, &r, &instance->alloc);
+	}
+	PROFILE_SET(NULL);
+}
+
+void sweep_order(SweepContext* context, SweepInstance* instance, OptimizePool* optimize_pool) {
+	PROFILE_SET(&instance->profile);
+	SweepConfig* config = context->config;
+	uint32 n = context->n;
+	instance->result.restarts = 0;
+	if (config->ordering == ORDERING_OPTIMIZE) {
+		OptimizeResult optimize_result;
+		if (config->warm_start && instance->m_index > 0) {
+			//out_var_pos still holds the layout of the previous m
+			for (uint32 i = 0; i < n; i++) {
+				uint32 pos = list_read(&instance->out_var_pos, i, uint32);
+				list_set(&instance->in_var_pos, i, &pos);
+			}
+			OptimizeBudget warm_budget;
+			warm_budget.max_restarts = 1 + config->warm_restarts;
+			warm_budget.max_seconds = 0;
+			warm_budget.max_restarts_without_improvement = 0;
+			optimize_result = optimize_instance_cached(config->ordering_cache, &instance->random_instance, n, &instance->out_var_pos, &instance->out_var_ring, &instance->optimized_instance, 1, optimize_pool, &warm_budget, &instance->in_var_pos, &instance->alloc);
+		}
+		else {
+			optimize_result = optimize_instance_cached(config->ordering_cache, &instance->random_instance, n, &instance->out_var_pos, &instance->out_var_ring, &instance->optimized_instance, 1, optimize_pool, &config->optimize_budget, NULL, &instance->alloc);
+		}
+		instance->result.restarts = optimize_result.restarts;
+	}
+	else {
+		order_instance(&instance->random_instance, n, config->ordering, config->refine_ordering, &instance->out_var_pos, &instance->out_var_ring, &instance->optimized_instance, 1, &instance->alloc);
+	}
+	PROFILE_SET(NULL);
+}
+
+void sweep_solve(SweepContext* context, SweepInstance* instance, Buffer* tree) {
+	PROFILE_SET(&instance->profile);
+	uint32 n = context->n;
+	buffer_reset(tree);
+	list_clear(&instance->tree_sizes);
+
+	//remap the vars to their new positions, solve on this transformed instance, and then transform the solution back.
+	transform_instance(&instance->out_var_pos, &instance->out_var_ring, n, &instance->optimized_instance, &instance->transformed_instance);
+
+	instance->result.solution_exists = solve_tree_instance_with_tree_size(&instance->transformed_instance, n, &instance->tree_sizes, tree, &instance->solution, &instance->alloc);
+
+	instance->result.max_tree_size = 0;
+	for (uint32 i = 0; i < instance->tree_sizes.length; i++) {
+		mem_index size = list_read(&instance->tree_sizes, i, mem_index);
+		if (size > instance->result.max_tree_size) {
+			instance->result.max_tree_size = size;
+		}
+	}
+	PROFILE_SET(NULL);
+}
+
+#define SWEEP_CHECKPOINT_MAGIC "3SATCKP3"
+
+/*
+ Parameters of the sweep that the results depend on, at the start of the checkpoint and results files.
+*/
+void sweep_checkpoint_header(SweepContext* context, uint32 header[13]) {
+	SweepConfig* config = context->config;
+	header[0] = context->n;
+	header[1] = context->m_start;
+	header[2] = context->m_inc;
+	header[3] = context->m_count;
+	header[4] = context->test_count;
+	header[5] = (uint32)config->ordering;
+	header[6] = config->refine_ordering;
+	header[7] = config->nested_instances;
+	header[8] = config->warm_start;
+	header[9] = config->warm_restarts;
+	header[10] = config->optimize_budget.max_restarts;
+	header[11] = config->optimize_budget.max_restarts_without_improvement;
+	header[12] = config->clause_tree_sizes;
+}
+
+//index and count of the shard of the sweep, (0, 1) without sharding
+void sweep_shard(SweepConfig* config, uint32 shard[2]) {
+	shard[0] = config->shard_count <= 1 ? 0 : config->shard_index;
+	shard[1] = config->shard_count <= 1 ? 1 : config->shard_count;
+}
+
+/*
+ Saves every result to config->checkpoint_path. The file is written next to it and then renamed, so a crash
+ leaves either the previous checkpoint or the new one. Called with results_lock held.
+ The random streams do not need to be saved: every instance derives its own from (m, test).
+*/
+void sweep_checkpoint_write(SweepContext* context) {
+	char* path = context->config->checkpoint_path;
+	char temp_path[1024];
+	assert(snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) < (int)sizeof(temp_path), "checkpoint path too long");
+	FILE* file = fopen(temp_path, "wb");
+	assert(file != NULL, "cannot open the checkpoint file");
+
+	uint32 header[13];
+	sweep_checkpoint_header(context, header);
+	uint32 shard[2];
+	sweep_shard(context->config, shard);
+	fwrite(SWEEP_CHECKPOINT_MAGIC, 1, 8, file);
+	fwrite(header, sizeof(uint32), 13, file);
+	fwrite(shard, sizeof(uint32), 2, file);
+	for (uint32 i = 0; i < context->results.length; i++) {
+		SweepTaskResult result = list_read(&context->results, i, SweepTaskResult);
+		uint8 flags[2] = { result.done, result.solution_exists };
+		uint64 max_tree_size = result.max_tree_size;
+		fwrite(flags, sizeof(uint8), 2, file);
+		fwrite(&max_tree_size, sizeof(uint64), 1, file);
+		fwrite(&result.restarts, sizeof(uint32), 1, file);
+	}
+	if (context->clause_histograms != NULL) {
+		fwrite(context->clause_histograms, sizeof(LogHistogram), context->m_count, file);
+	}
+	bool written = fflush(file) == 0;
+	fclose(file);
+#if defined(_WIN32)
+	//rename does not replace an existing file there
+	remove(path);
+#endif
+	assert(written && rename(temp_path, path) == 0, "cannot write the checkpoint file");
+	context->checkpoint_time = std::chrono::steady_clock::now();
+}
+
+/*
+ Loads the results of config->checkpoint_path, if the file exists. It has to come from the same sweep and shard.
+*/
+void sweep_checkpoint_read(SweepContext* context) {
+	FILE* file = fopen(context->config->checkpoint_path, "rb");
+	if (file == NULL) return;
+
+	char magic[8];
+	uint32 header[13];
+	uint32 file_header[13];
+	uint32 shard[2];
+	uint32 file_shard[2];
+	sweep_checkpoint_header(context, header);
+	sweep_shard(context->config, shard);
+	bool valid = fread(magic, 1, 8, file) == 8 && memcmp(magic, SWEEP_CHECKPOINT_MAGIC, 8) == 0;
+	valid = valid && fread(file_header, sizeof(uint32), 13, file) == 13 && memcmp(header, file_header, sizeof(header)) == 0;
+	valid = valid && fread(file_shard, sizeof(uint32), 2, file) == 2 && memcmp(shard, file_shard, sizeof(shard)) == 0;
+	for (uint32 i = 0; valid && i < context->results.length; i++) {
+		uint8 flags[2];
+		uint64 max_tree_size;
+		SweepTaskResult result;
+		valid = fread(flags, sizeof(uint8), 2, file) == 2 && fread(&max_tree_size, sizeof(uint64), 1, file) == 1 && fread(&result.restarts, sizeof(uint32), 1, file) == 1;
+		result.done = flags[0] != 0;
+		result.solution_exists = flags[1] != 0;
+		result.max_tree_size = (mem_index)max_tree_size;
+		list_set(&context->results, i, &result);
+	}
+	if (valid && context->clause_histograms != NULL) {
+		valid = fread(context->clause_histograms, sizeof(LogHistogram), context->m_count, file) == context->m_count;
+	}
+	fclose(file);
+	assert(valid, "the checkpoint file does not match the sweep");
+}
+
+void sweep_verify(SweepContext* context, SweepInstance* instance) {
+	PROFILE_SET(&instance->profile);
+	if (instance->result.solution_exists && context->test_sol) {
+		test_solution(&instance->transformed_instance, &instance->solution, context->n, false);
+		transform_solution(&instance->solution, &instance->out_solution, &instance->out_var_ring, context->n);
+		test_solution(&instance->random_instance, &instance->out_solution, context->n, false);
+	}
+	PROFILE_SET(NULL);
+	instance->result.done = true;
+
+	//the other workers only count their instances, so the progress lines do not interleave
+	uint32 done = ++context->instances_done;
+	if (std::this_thread::get_id() == context->progress_thread && done >= context->instances_printed + 10) {
+		context->instances_printed = done;
+		printf("m = %d - instances done count = %u\n", context->m_start + instance->m_index * context->m_inc, done);
+	}
+
+	std::lock_guard<std::mutex> guard(context->results_lock);
+	uint32 slot = instance->m_index * context->test_count + instance->test;
+	//a chain resumed part-way runs its done instances again: they are already in the results and histograms
+	SweepTaskResult previous = list_read(&context->results, slot, SweepTaskResult);
+	list_set(&context->results, slot, &instance->result);
+	profile_merge(&context->profiles[instance->m_index], &instance->profile);
+	if (context->clause_histograms != NULL && !previous.done) {
+		LogHistogram* histogram = &context->clause_histograms[instance->m_index];
+		for (uint32 i = 0; i < instance->tree_sizes.length; i++) {
+			log_histogram_add(histogram, list_read(&instance->tree_sizes, i, mem_index));
+		}
+	}
+	if (context->config->checkpoint_path != NULL && seconds_since(context->checkpoint_time) >= context->config->checkpoint_seconds) {
+		sweep_checkpoint_write(context);
 	}
+}
 
-	List tree_sizes;
-	list_init(&tree_sizes, alloc, sizeof(mem_index), 100, false);
-	List volume_sizes;
-	list_init(&volume_sizes, alloc, sizeof(real64), 100, false);
-	List solution;
-	list_init(&solution, alloc, sizeof(bool), n, true);
+uint32 sweep_task_slot(SweepContext* context, uint32 task) {
+	if (context->chained || context->task_slots == NULL) return task;
+	return list_read(context->task_slots, task, uint32);
+}
 
-	Buffer tree;
-	buffer_init(&tree, 500000);
+/*
+ Tasks are dealt to the shards in turn, so every shard gets about as many tests of every m.
+*/
+bool sweep_task_in_shard(SweepContext* context, uint32 task) {
+	uint32 shard_count = context->config->shard_count;
+	return shard_count <= 1 || sweep_task_slot(context, task) % shard_count == context->config->shard_index;
+}
 
-	while (count++ < shuffle_count) {
+/*
+ A task is done when all of its instances are (a chain that was stopped before its end runs again from its start).
+*/
+bool sweep_task_done(SweepContext* context, uint32 task) {
+	task = sweep_task_slot(context, task);
+	uint32 test_count = context->test_count;
+	uint32 m_index_start = context->chained ? 0 : task / test_count;
+	uint32 m_index_end = context->chained ? context->m_count : m_index_start + 1;
+	uint32 test = context->chained ? task : task % test_count;
+	std::lock_guard<std::mutex> guard(context->results_lock);
+	for (uint32 m_index = m_index_start; m_index < m_index_end; m_index++) {
+		SweepTaskResult result = list_read(&context->results, m_index * test_count + test, SweepTaskResult);
+		if (!result.done) return false;
+	}
+	return true;
+}
 
-		//shuffle the clauses
-		if (shuffle) {
-			for (uint32 i = 0; i < length; i++) {
-				int rng = length - i;
-				int j = i + rand_next_int(rand, rng); //j is between between [i, length - 1]
-				//if j != j, swap element i with element i+j
-				if (i != j) {
-					Clause ci = list_read(instance, i, Clause);
-					Clause cj = list_read(instance, j, Clause);
-					list_set(instance, i, &cj);
-					list_set(instance, j, &ci);
-				}
+/*
+ Takes the next task of a worker, stealing from the other workers once its own tasks are done.
+ Returns false when there is no task left.
+*/
+bool sweep_next_task(SweepContext* context, uint32 worker_index, uint32* task) {
+	TaskRange* own = &context->workers[worker_index].tasks;
+	{
+		std::lock_guard<std::mutex> guard(own->lock);
+		if (own->begin < own->end) {
+			*task = --own->end;
+			return true;
+		}
+	}
+	for (uint32 k = 1; k < context->worker_count; k++) {
+		TaskRange* victim = &context->workers[(worker_index + k) % context->worker_count].tasks;
+		uint32 steal_begin = 0;
+		uint32 steal_end = 0;
+		{
+			std::lock_guard<std::mutex> guard(victim->lock);
+			if (victim->begin < victim->end) {
+				steal_begin = victim->begin;
+				steal_end = victim->begin + (victim->end - victim->begin + 1) / 2;
+				victim->begin = steal_end;
 			}
 		}
+		if (steal_begin < steal_end) {
+			std::lock_guard<std::mutex> guard(own->lock);
+			own->begin = steal_begin + 1;
+			own->end = steal_end;
+			*task = steal_begin;
+			return true;
+		}
+	}
+	return false;
+}
 
-		list_clear(&tree_sizes);
-		list_clear(&volume_sizes);
+/*
+ Runs all the stages of the instances of one task.
+*/
+void sweep_run_task(SweepContext* context, SweepWorker* worker, uint32 task) {
+	if (!sweep_task_in_shard(context, task) || sweep_task_done(context, task)) return;
+	task = sweep_task_slot(context, task);
+	SweepInstance* instance = &worker->instance;
+	uint32 test_count = context->test_count;
+	instance->test = context->chained ? task : task % test_count;
+	uint32 m_index_start = context->chained ? 0 : task / test_count;
+	uint32 m_index_end = context->chained ? context->m_count : m_index_start + 1;
+
+	Rand chain_rand;
+	rand_set_seed(&chain_rand, rand_derive_seed(1, instance->test));
+	list_clear(&instance->random_instance);
+
+	for (uint32 m_index = m_index_start; m_index < m_index_end; m_index++) {
+		instance->m_index = m_index;
+		sweep_generate(context, instance, &chain_rand);
+		sweep_order(context, instance, &worker->optimize_pool);
+		sweep_solve(context, instance, &worker->tree);
+		sweep_verify(context, instance);
+	}
+}
 
-		buffer_reset(&tree);
-		list_clear(&tree_sizes);
-		bool solution_exists = solve_tree_instance_with_tree_size(instance, n, &tree_sizes, &tree, &solution, alloc);
+void sweep_worker_run(SweepContext* context, uint32 worker_index) {
+	uint32 task = 0;
+	while (sweep_next_task(context, worker_index, &task)) {
+		sweep_run_task(context, &context->workers[worker_index], task);
+	}
+}
 
-		//scan for maximum
-		mem_index max_size = 0;
-		for (uint32 i = 0; i < tree_sizes.length; i++) {
-			mem_index size = list_read(&tree_sizes, i, mem_index);
-			if (size > max_size) {
-				max_size = size;
-			}
+/*
+ Worker of a pipeline stage: takes instances from the queue of its stage (or from the free handles, for the first
+ stage) and hands them to the next stage (or back to the free handles, for the last one).
+ The last worker of a stage to run out of work closes the queue of the next stage.
+*/
+void sweep_stage_run(SweepContext* context, StageWorker* worker) {
+	PipelineStage stage = worker->stage;
+	while (true) {
+		uint32 handle = 0;
+		if (stage == STAGE_GENERATE) {
+			uint32 task = context->next_task++;
+			if (task >= context->task_count) break;
+			if (!sweep_task_in_shard(context, task) || sweep_task_done(context, task)) continue;
+			handle_queue_pop(&context->free_handles, &handle);
+			SweepInstance* instance = &context->pool[handle];
+			uint32 slot = sweep_task_slot(context, task);
+			instance->m_index = slot / context->test_count;
+			instance->test = slot % context->test_count;
+			sweep_generate(context, instance, NULL);
 		}
-		avg_max_tree_size += max_size;
+		else {
+			if (!handle_queue_pop(&context->stage_queues[stage], &handle)) break;
+			SweepInstance* instance = &context->pool[handle];
+			if (stage == STAGE_ORDER) sweep_order(context, instance, &worker->optimize_pool);
+			else if (stage == STAGE_SOLVE) sweep_solve(context, instance, &worker->tree);
+			else sweep_verify(context, instance);
+		}
+		if (stage + 1 < PIPELINE_STAGE_COUNT) {
+			handle_queue_push(&context->stage_queues[stage + 1], handle);
+		}
+		else {
+			handle_queue_push(&context->free_handles, handle);
+		}
+	}
+	if (--context->stage_running[stage] == 0 && stage + 1 < PIPELINE_STAGE_COUNT) {
+		handle_queue_close(&context->stage_queues[stage + 1]);
+	}
+}
 
-		if (max_max_tree_size < max_size) {
-			max_max_tree_size = max_size;
-			list_clear(max_size_instance);
-			list_clear(max_sizes);
-			for (uint32 i = 0; i < instance->length; i++) {
-				Clause c = list_read(instance, i, Clause);
-				list_add(max_size_instance, &c);
-				mem_index s = list_read(&tree_sizes, i, mem_index);
-				list_add(max_sizes, &s);
+/*
+ Thread t of a sweep: worker t + 1 of the task pool, or stage worker t of the pipeline, for every run.
+*/
+void sweep_thread(SweepContext* context, uint32 t) {
+	uint64 generation = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> guard(context->threads_lock);
+			while (!context->threads_quit && context->run_generation == generation) {
+				context->run_start.wait(guard);
 			}
+			if (context->threads_quit) break;
+			generation = context->run_generation;
+		}
+		if (context->stage_workers != NULL) {
+			sweep_stage_run(context, &context->stage_workers[t]);
+		}
+		else if (t + 1 < context->worker_count) {
+			sweep_worker_run(context, t + 1);
+		}
+		std::lock_guard<std::mutex> guard(context->threads_lock);
+		if (--context->threads_running == 0) {
+			context->run_done.notify_one();
 		}
+	}
+}
 
-		if (max_size < min_max_tree_size) {
-			min_max_tree_size = max_size;
-			list_clear(min_size_instance);
-			list_clear(min_sizes);
-			for (uint32 i = 0; i < instance->length; i++) {
-				Clause c = list_read(instance, i, Clause);
-				list_add(min_size_instance, &c);
-				mem_index s = list_read(&tree_sizes, i, mem_index);
-				list_add(min_sizes, &s);
+void sweep_threads_init(SweepContext* context, uint32 thread_count) {
+	context->thread_count = thread_count;
+	context->run_generation = 0;
+	context->threads_running = 0;
+	context->threads_quit = false;
+	context->threads = new std::thread[thread_count];
+	for (uint32 t = 0; t < thread_count; t++) {
+		context->threads[t] = std::thread(sweep_thread, context, t);
+	}
+}
+
+void sweep_threads_free(SweepContext* context) {
+	{
+		std::lock_guard<std::mutex> guard(context->threads_lock);
+		context->threads_quit = true;
+		context->run_start.notify_all();
+	}
+	for (uint32 t = 0; t < context->thread_count; t++) {
+		context->threads[t].join();
+	}
+	delete[] context->threads;
+}
+
+//starts a run on the threads, once it is set up
+void sweep_threads_begin(SweepContext* context) {
+	std::lock_guard<std::mutex> guard(context->threads_lock);
+	context->threads_running = context->thread_count;
+	context->run_generation++;
+	context->run_start.notify_all();
+}
+
+//waits for the threads to finish the run
+void sweep_threads_end(SweepContext* context) {
+	std::unique_lock<std::mutex> guard(context->threads_lock);
+	while (context->threads_running > 0) {
+		context->run_done.wait(guard);
+	}
+}
+
+/*
+ Allocates the workers of the task pool, which sweep_run_tasks keeps for the next runs (sweep_run_adaptive and
+ find_threshold run a sweep per batch).
+*/
+void sweep_tasks_init(SweepContext* context, uint32 m_end, Allocator* alloc) {
+	context->worker_capacity = context->config->sweep_thread_count < 1 ? 1 : context->config->sweep_thread_count;
+	context->workers = new SweepWorker[context->worker_capacity];
+	for (uint32 w = 0; w < context->worker_capacity; w++) {
+		sweep_instance_init(&context->workers[w].instance, context->n, m_end, alloc);
+		buffer_init(&context->workers[w].tree, 500000);
+		optimize_pool_init(&context->workers[w].optimize_pool, context->config->thread_count);
+		optimize_pool_reserve(&context->workers[w].optimize_pool, context->n, m_end);
+	}
+	sweep_threads_init(context, context->worker_capacity - 1);
+}
+
+void sweep_tasks_free(SweepContext* context) {
+	sweep_threads_free(context);
+	for (uint32 w = 0; w < context->worker_capacity; w++) {
+		optimize_pool_free(&context->workers[w].optimize_pool);
+		buffer_free(&context->workers[w].tree);
+		sweep_instance_free(&context->workers[w].instance);
+	}
+	delete[] context->workers;
+	context->workers = NULL;
+}
+
+/*
+ Runs every task on config->sweep_thread_count workers.
+*/
+void sweep_run_tasks(SweepContext* context, uint32 m_end, Allocator* alloc) {
+	if (context->workers == NULL) {
+		sweep_tasks_init(context, m_end, alloc);
+	}
+	context->worker_count = context->worker_capacity;
+	if (context->worker_count > context->task_count) context->worker_count = context->task_count;
+
+	for (uint32 w = 0; w < context->worker_count; w++) {
+		context->workers[w].tasks.begin = (uint32)(((uint64)context->task_count * w) / context->worker_count);
+		context->workers[w].tasks.end = (uint32)(((uint64)context->task_count * (w + 1)) / context->worker_count);
+	}
+
+	sweep_threads_begin(context);
+	sweep_worker_run(context, 0);
+	sweep_threads_end(context);
+}
+
+/*
+ Allocates the instance pool, the queues and the stage workers of the pipeline, which sweep_run_pipeline keeps for
+ the next runs: there are enough instances to fill every queue and keep every worker busy.
+*/
+void sweep_pipeline_init(SweepContext* context, uint32 m_end, Allocator* alloc) {
+	SweepConfig* config = context->config;
+	uint32 queue_size = config->pipeline_queue_size < 1 ? 1 : config->pipeline_queue_size;
+	context->stage_worker_count = 0;
+	for (uint32 s = 0; s < PIPELINE_STAGE_COUNT; s++) {
+		context->stage_worker_count += config->pipeline_threads[s] < 1 ? 1 : config->pipeline_threads[s];
+	}
+	context->stage_workers = new StageWorker[context->stage_worker_count];
+	uint32 t = 0;
+	for (uint32 s = 0; s < PIPELINE_STAGE_COUNT; s++) {
+		uint32 stage_threads = config->pipeline_threads[s] < 1 ? 1 : config->pipeline_threads[s];
+		for (uint32 k = 0; k < stage_threads; k++) {
+			StageWorker* worker = &context->stage_workers[t++];
+			worker->stage = (PipelineStage)s;
+			if (s == STAGE_SOLVE) {
+				buffer_init(&worker->tree, 500000);
+			}
+			if (s == STAGE_ORDER) {
+				optimize_pool_init(&worker->optimize_pool, config->thread_count);
+				optimize_pool_reserve(&worker->optimize_pool, context->n, m_end);
 			}
 		}
+	}
 
-		if (solution_exists) {
-			bool works = test_solution(instance, &solution, n, false);
-			assert(works, "failed solution!");
+	context->pool_size = (PIPELINE_STAGE_COUNT - 1) * queue_size + context->stage_worker_count;
+	context->pool = (SweepInstance*)malloc(context->pool_size * sizeof(SweepInstance));
+	handle_queue_init(&context->free_handles, context->pool_size, alloc);
+	for (uint32 h = 0; h < context->pool_size; h++) {
+		sweep_instance_init(&context->pool[h], context->n, m_end, alloc);
+		handle_queue_push(&context->free_handles, h);
+	}
+	for (uint32 s = 1; s < PIPELINE_STAGE_COUNT; s++) {
+		handle_queue_init(&context->stage_queues[s], queue_size, alloc);
+	}
+	sweep_threads_init(context, context->stage_worker_count - 1);
+}
+
+void sweep_pipeline_free(SweepContext* context) {
+	sweep_threads_free(context);
+	for (uint32 s = 1; s < PIPELINE_STAGE_COUNT; s++) {
+		handle_queue_free(&context->stage_queues[s]);
+	}
+	for (uint32 h = 0; h < context->pool_size; h++) {
+		sweep_instance_free(&context->pool[h]);
+	}
+	handle_queue_free(&context->free_handles);
+	free(context->pool);
+	context->pool = NULL;
+	for (uint32 t = 0; t < context->stage_worker_count; t++) {
+		StageWorker* worker = &context->stage_workers[t];
+		if (worker->stage == STAGE_SOLVE) {
+			buffer_free(&worker->tree);
+		}
+		if (worker->stage == STAGE_ORDER) {
+			optimize_pool_free(&worker->optimize_pool);
 		}
-		printf("max max tree size: %zu\n" + max_max_tree_size);
-		printf("min max tree size: %zu\n" + min_max_tree_size);
 	}
+	delete[] context->stage_workers;
+	context->stage_workers = NULL;
+}
 
-	avg_max_tree_size = avg_max_tree_size / shuffle_count;
+/*
+ Runs every (m, test) instance through the generate, order, solve and verify stages, each stage with its own
+ workers (config->pipeline_threads), connected by queues of config->pipeline_queue_size instances.
+ The instances are allocated once and recycled, also across runs.
+*/
+void sweep_run_pipeline(SweepContext* context, uint32 m_end, Allocator* alloc) {
+	if (context->pool == NULL) {
+		sweep_pipeline_init(context, m_end, alloc);
+	}
+	else {
+		for (uint32 s = 1; s < PIPELINE_STAGE_COUNT; s++) {
+			handle_queue_reopen(&context->stage_queues[s]);
+		}
+	}
+	for (uint32 t = 0; t < context->stage_worker_count; t++) {
+		context->stage_running[context->stage_workers[t].stage] = 0;
+	}
+	for (uint32 t = 0; t < context->stage_worker_count; t++) {
+		context->stage_running[context->stage_workers[t].stage]++;
+	}
+	context->next_task = 0;
 
-	printf("avg max tree size: %zu" + avg_max_tree_size);
+	//the calling thread is the last worker, of the last stage
+	sweep_threads_begin(context);
+	sweep_stage_run(context, &context->stage_workers[context->stage_worker_count - 1]);
+	sweep_threads_end(context);
+}
 
-	printf("max sizes: \n");
-	list_print_mem_index(max_sizes);
-	printf("min sizes: \n");
-	list_print_mem_index(min_sizes);
+/*
+ Sets up the results of a sweep, and loads them from the checkpoint file with config->resume.
+*/
+void sweep_context_init(SweepContext* context, uint32 n, uint32 m_start, uint32 m_end, uint32 m_inc, uint32 test_count, SweepConfig* config, Allocator* alloc, bool test_sol) {
+	context->n = n;
+	context->m_start = m_start;
+	context->m_inc = m_inc;
+	context->m_count = (m_end - m_start) / m_inc + 1;
+	context->test_count = test_count;
+	context->config = config;
+	context->test_sol = test_sol;
+	//the layout of the previous m is only a good start when the instance at m extends it
+	assert(!config->warm_start || config->nested_instances, "warm_start needs nested_instances");
+	context->chained = config->nested_instances;
+	context->task_count = context->chained ? test_count : context->m_count * test_count;
+	context->task_slots = NULL;
+	list_init(&context->results, alloc, sizeof(SweepTaskResult), context->m_count * test_count, true);
+	list_set_to_zero(&context->results);
+	context->clause_histograms = NULL;
+	if (config->clause_tree_sizes) {
+		context->clause_histograms = (LogHistogram*)malloc(context->m_count * sizeof(LogHistogram));
+		for (uint32 m_index = 0; m_index < context->m_count; m_index++) {
+			log_histogram_init(&context->clause_histograms[m_index]);
+		}
+	}
+	context->profiles = (Profile*)malloc(context->m_count * sizeof(Profile));
+	for (uint32 m_index = 0; m_index < context->m_count; m_index++) {
+		profile_init(&context->profiles[m_index]);
+	}
+	context->checkpoint_time = std::chrono::steady_clock::now();
+	context->instances_done = 0;
+	context->progress_thread = std::this_thread::get_id();
+	context->instances_printed = 0;
+	context->workers = NULL;
+	context->pool = NULL;
+	context->stage_workers = NULL;
+	if (config->checkpoint_path != NULL && config->resume) {
+		sweep_checkpoint_read(context);
+	}
+#if defined(THREE_SAT_PROFILE)
+	if (config->trace_path != NULL) {
+		trace_start(config->trace_path, config->trace_events_per_thread);
+	}
+#endif
+}
+
+void sweep_context_free(SweepContext* context) {
+	if (context->workers != NULL) {
+		sweep_tasks_free(context);
+	}
+	if (context->pool != NULL) {
+		sweep_pipeline_free(context);
+	}
+#if defined(THREE_SAT_PROFILE)
+	if (context->config->trace_path != NULL) {
+		trace_stop();
+	}
+#endif
+	free(context->profiles);
+	if (context->clause_histograms != NULL) {
+		free(context->clause_histograms);
+	}
+	list_free(&context->results);
+}
+
+/*
+ Statistics of the instances of one m, that the shards of a sweep add up.
+*/
+struct SweepSummary {
+	uint64 test_count;
+	uint64 solution_count;
+	uint64 restart_count;
+	RunningStats max_tree_sizes;
+	LogHistogram max_tree_size_histogram;
+	LogHistogram clause_tree_size_histogram;
+	Profile profile; //of the instances run by this process (empty without THREE_SAT_PROFILE)
+};
+
+void sweep_summary_init(SweepSummary* summary) {
+	summary->test_count = 0;
+	summary->solution_count = 0;
+	summary->restart_count = 0;
+	running_stats_init(&summary->max_tree_sizes);
+	log_histogram_init(&summary->max_tree_size_histogram);
+	log_histogram_init(&summary->clause_tree_size_histogram);
+	profile_init(&summary->profile);
+}
+
+void sweep_summary_add(SweepSummary* summary, SweepTaskResult* result) {
+	summary->test_count++;
+	if (result->solution_exists) summary->solution_count++;
+	summary->restart_count += result->restarts;
+	running_stats_add(&summary->max_tree_sizes, (real64)result->max_tree_size);
+	log_histogram_add(&summary->max_tree_size_histogram, result->max_tree_size);
+}
+
+void sweep_summary_merge(SweepSummary* summary, SweepSummary* other) {
+	summary->test_count += other->test_count;
+	summary->solution_count += other->solution_count;
+	summary->restart_count += other->restart_count;
+	running_stats_merge(&summary->max_tree_sizes, &other->max_tree_sizes);
+	log_histogram_merge(&summary->max_tree_size_histogram, &other->max_tree_size_histogram);
+	log_histogram_merge(&summary->clause_tree_size_histogram, &other->clause_tree_size_histogram);
+	profile_merge(&summary->profile, &other->profile);
+}
+
+void sweep_summary_print(SweepSummary* summary, uint32 m, bool print_test_count, bool clause_tree_sizes, bool print_histograms) {
+	printf("m = %d\n", m);
+	if (print_test_count) {
+		printf("tests: %llu\n", (unsigned long long)summary->test_count);
+	}
+	printf("average max tree size: %lf\n", summary->max_tree_sizes.mean);
+	printf("max tree size standard deviation: %lf\n", sqrt(running_stats_variance(&summary->max_tree_sizes)));
+	printf("max max tree size: %zu\n", (mem_index)summary->max_tree_sizes.max);
+	printf("min max tree size: %zu\n", (mem_index)summary->max_tree_sizes.min);
+	log_histogram_print_percentiles(&summary->max_tree_size_histogram, "max tree size");
+	if (print_histograms) {
+		log_histogram_print(&summary->max_tree_size_histogram, "max tree size");
+	}
+	if (clause_tree_sizes) {
+		log_histogram_print_percentiles(&summary->clause_tree_size_histogram, "clause tree size");
+		if (print_histograms) {
+			log_histogram_print(&summary->clause_tree_size_histogram, "clause tree size");
+		}
+	}
+	printf("average optimize restarts: %lf\n", (real64)summary->restart_count / (real64)summary->test_count);
+#if defined(THREE_SAT_PROFILE)
+	profile_print(&summary->profile);
+#endif
+}
+
+#define SWEEP_RESULTS_MAGIC "3SATRSLT"
+#define SWEEP_RESULTS_VERSION 1
+
+/*
+ Fields of the results file, little endian whatever the byte order of the machine, so that the shards of a sweep
+ can be merged on another machine or by another build. The read functions return false at the end of the file.
+*/
+void file_write_uint32(FILE* file, uint32 value) {
+	uint8 bytes[4];
+	for (uint32 k = 0; k < 4; k++) {
+		bytes[k] = (uint8)(value >> (8 * k));
+	}
+	fwrite(bytes, 1, 4, file);
+}
+
+void file_write_uint64(FILE* file, uint64 value) {
+	uint8 bytes[8];
+	for (uint32 k = 0; k < 8; k++) {
+		bytes[k] = (uint8)(value >> (8 * k));
+	}
+	fwrite(bytes, 1, 8, file);
+}
+
+void file_write_real64(FILE* file, real64 value) {
+	uint64 bits;
+	memcpy(&bits, &value, sizeof(bits));
+	file_write_uint64(file, bits);
+}
+
+bool file_read_uint32(FILE* file, uint32* value) {
+	uint8 bytes[4];
+	if (fread(bytes, 1, 4, file) != 4) return false;
+	*value = 0;
+	for (uint32 k = 0; k < 4; k++) {
+		*value |= (uint32)bytes[k] << (8 * k);
+	}
+	return true;
+}
+
+bool file_read_uint64(FILE* file, uint64* value) {
+	uint8 bytes[8];
+	if (fread(bytes, 1, 8, file) != 8) return false;
+	*value = 0;
+	for (uint32 k = 0; k < 8; k++) {
+		*value |= (uint64)bytes[k] << (8 * k);
+	}
+	return true;
+}
+
+bool file_read_real64(FILE* file, real64* value) {
+	uint64 bits;
+	if (!file_read_uint64(file, &bits)) return false;
+	memcpy(value, &bits, sizeof(bits));
+	return true;
+}
+
+void log_histogram_write(FILE* file, LogHistogram* histogram) {
+	file_write_uint64(file, histogram->total);
+	file_write_uint64(file, histogram->max);
+	for (uint32 b = 0; b < LOG_HISTOGRAM_BUCKET_COUNT; b++) {
+		file_write_uint64(file, histogram->counts[b]);
+	}
+}
+
+bool log_histogram_read(FILE* file, LogHistogram* histogram) {
+	bool valid = file_read_uint64(file, &histogram->total) && file_read_uint64(file, &histogram->max);
+	for (uint32 b = 0; valid && b < LOG_HISTOGRAM_BUCKET_COUNT; b++) {
+		valid = file_read_uint64(file, &histogram->counts[b]);
+	}
+	return valid;
+}
+
+/*
+ A SweepSummary, field by field: the counts, the max tree size statistics and histograms, and the profile.
+*/
+void sweep_summary_write(FILE* file, SweepSummary* summary) {
+	file_write_uint64(file, summary->test_count);
+	file_write_uint64(file, summary->solution_count);
+	file_write_uint64(file, summary->restart_count);
+	file_write_uint64(file, summary->max_tree_sizes.count);
+	file_write_real64(file, summary->max_tree_sizes.mean);
+	file_write_real64(file, summary->max_tree_sizes.m2);
+	file_write_real64(file, summary->max_tree_sizes.min);
+	file_write_real64(file, summary->max_tree_sizes.max);
+	log_histogram_write(file, &summary->max_tree_size_histogram);
+	log_histogram_write(file, &summary->clause_tree_size_histogram);
+	for (uint32 p = 0; p < PROFILE_PHASE_COUNT; p++) {
+		file_write_uint64(file, summary->profile.phase_nanoseconds[p]);
+		file_write_uint64(file, summary->profile.phase_calls[p]);
+		for (uint32 h = 0; h < HARDWARE_COUNTER_COUNT; h++) {
+			file_write_uint64(file, summary->profile.hardware[p][h]);
+		}
+	}
+	for (uint32 c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+		file_write_uint64(file, summary->profile.counters[c]);
+	}
+}
+
+bool sweep_summary_read(FILE* file, SweepSummary* summary) {
+	bool valid = file_read_uint64(file, &summary->test_count) && file_read_uint64(file, &summary->solution_count) && file_read_uint64(file, &summary->restart_count);
+	valid = valid && file_read_uint64(file, &summary->max_tree_sizes.count) && file_read_real64(file, &summary->max_tree_sizes.mean) && file_read_real64(file, &summary->max_tree_sizes.m2);
+	valid = valid && file_read_real64(file, &summary->max_tree_sizes.min) && file_read_real64(file, &summary->max_tree_sizes.max);
+	valid = valid && log_histogram_read(file, &summary->max_tree_size_histogram) && log_histogram_read(file, &summary->clause_tree_size_histogram);
+	for (uint32 p = 0; valid && p < PROFILE_PHASE_COUNT; p++) {
+		valid = file_read_uint64(file, &summary->profile.phase_nanoseconds[p]) && file_read_uint64(file, &summary->profile.phase_calls[p]);
+		for (uint32 h = 0; valid && h < HARDWARE_COUNTER_COUNT; h++) {
+			valid = file_read_uint64(file, &summary->profile.hardware[p][h]);
+		}
+	}
+	for (uint32 c = 0; valid && c < PROFILE_COUNTER_COUNT; c++) {
+		valid = file_read_uint64(file, &summary->profile.counters[c]);
+	}
+	return valid;
+}
+
+/*
+ Writes the summary of every m to config->results_path: the magic, the version, the sweep parameters (as in the
+ checkpoint), the shard, the sizes of the summary arrays, and the summaries. The file is written next to it and then
+ renamed, like the checkpoint.
+*/
+void sweep_results_write(SweepContext* context, SweepSummary* summaries) {
+	SweepConfig* config = context->config;
+	char temp_path[1024];
+	assert(snprintf(temp_path, sizeof(temp_path), "%s.tmp", config->results_path) < (int)sizeof(temp_path), "results path too long");
+	FILE* file = fopen(temp_path, "wb");
+	assert(file != NULL, "cannot open the results file");
+
+	uint32 header[13];
+	sweep_checkpoint_header(context, header);
+	uint32 shard[2];
+	sweep_shard(config, shard);
+	fwrite(SWEEP_RESULTS_MAGIC, 1, 8, file);
+	file_write_uint32(file, SWEEP_RESULTS_VERSION);
+	for (uint32 k = 0; k < 13; k++) {
+		file_write_uint32(file, header[k]);
+	}
+	file_write_uint32(file, shard[0]);
+	file_write_uint32(file, shard[1]);
+	uint32 sizes[4] = { LOG_HISTOGRAM_BUCKET_COUNT, PROFILE_PHASE_COUNT, HARDWARE_COUNTER_COUNT, PROFILE_COUNTER_COUNT };
+	for (uint32 k = 0; k < 4; k++) {
+		file_write_uint32(file, sizes[k]);
+	}
+	for (uint32 m_index = 0; m_index < context->m_count; m_index++) {
+		sweep_summary_write(file, &summaries[m_index]);
+	}
+	bool written = fflush(file) == 0;
+	fclose(file);
+#if defined(_WIN32)
+	remove(config->results_path);
+#endif
+	assert(written && rename(temp_path, config->results_path) == 0, "cannot write the results file");
+}
+
+/*
+ Combines the results files of the shards of a sweep (any subset of them, each at most once) into the stats curve
+ and the tree size summaries, printed as by compute_transition_stats.
+*/
+void merge_sweep_results(char** paths, uint32 path_count, List* stats, bool print_histograms) {
+	assert(path_count > 0, "no results file to merge");
+	uint32 header[13];
+	uint32 shard_count = 0;
+	SweepSummary* summaries = NULL;
+	SweepSummary* file_summaries = NULL;
+	bool* merged_shards = NULL;
+	for (uint32 f = 0; f < path_count; f++) {
+		FILE* file = fopen(paths[f], "rb");
+		assert(file != NULL, "cannot open a results file");
+		char magic[8];
+		uint32 version = 0;
+		uint32 file_header[13];
+		uint32 shard[2];
+		uint32 sizes[4];
+		uint32 expected_sizes[4] = { LOG_HISTOGRAM_BUCKET_COUNT, PROFILE_PHASE_COUNT, HARDWARE_COUNTER_COUNT, PROFILE_COUNTER_COUNT };
+		bool valid = fread(magic, 1, 8, file) == 8 && memcmp(magic, SWEEP_RESULTS_MAGIC, 8) == 0;
+		valid = valid && file_read_uint32(file, &version);
+		assert(valid && version == SWEEP_RESULTS_VERSION, "not a results file of this version");
+		for (uint32 k = 0; valid && k < 13; k++) {
+			valid = file_read_uint32(file, &file_header[k]);
+		}
+		valid = valid && file_read_uint32(file, &shard[0]) && file_read_uint32(file, &shard[1]);
+		for (uint32 k = 0; valid && k < 4; k++) {
+			valid = file_read_uint32(file, &sizes[k]);
+		}
+		assert(valid && shard[0] < shard[1], "invalid results file");
+		assert(memcmp(sizes, expected_sizes, sizeof(sizes)) == 0, "the results file has other histogram or profile sizes");
+		uint32 m_count = file_header[3];
+		if (f == 0) {
+			memcpy(header, file_header, sizeof(header));
+			shard_count = shard[1];
+			summaries = (SweepSummary*)malloc(m_count * sizeof(SweepSummary));
+			file_summaries = (SweepSummary*)malloc(m_count * sizeof(SweepSummary));
+			merged_shards = (bool*)calloc(shard_count, sizeof(bool));
+			for (uint32 m_index = 0; m_index < m_count; m_index++) {
+				sweep_summary_init(&summaries[m_index]);
+			}
+		}
+		assert(memcmp(header, file_header, sizeof(header)) == 0 && shard[1] == shard_count, "the results files are not from the same sweep");
+		assert(!merged_shards[shard[0]], "a shard is merged twice");
+		merged_shards[shard[0]] = true;
+		for (uint32 m_index = 0; valid && m_index < m_count; m_index++) {
+			valid = sweep_summary_read(file, &file_summaries[m_index]);
+		}
+		fclose(file);
+		assert(valid, "truncated results file");
+		for (uint32 m_index = 0; m_index < m_count; m_index++) {
+			sweep_summary_merge(&summaries[m_index], &file_summaries[m_index]);
+		}
+	}
 
-	buffer_free(&tree);
+	printf("merged %u of %u shards\n", path_count, shard_count);
+	uint32 m_start = header[1];
+	uint32 m_inc = header[2];
+	for (uint32 m_index = 0; m_index < header[3]; m_index++) {
+		sweep_summary_print(&summaries[m_index], m_start + m_index * m_inc, true, header[12] != 0, print_histograms);
+		real32 proportion = (real32)summaries[m_index].solution_count / (real32)summaries[m_index].test_count;
+		list_add(stats, &proportion);
+	}
+	free(merged_shards);
+	free(file_summaries);
+	free(summaries);
 }
 
 /*
- Generates and solves random 3-SAT instances for a given n variables, with m (the number of clauses) in [m_start, m_end], with increment m_inc
- test_count instances are generated for every value of m.
- Gor a given m, the proportion between the count of instances that have a solution vs the total instance count is stored in stats.
+ Runs the tasks of the context, through the pipeline when config->pipeline_threads is set.
 */
-void compute_transition_stats(uint32 n, uint32 m_start, uint32 m_end, uint32 m_inc, uint32 test_count, List* stats, Allocator* alloc, bool test_sol) {
-
-	uint32 m1 = m_start;
-
-	List optimized_instance;
-	list_init(&optimized_instance, alloc, sizeof(Clause), m_end, false);
-
-	List random_instance;
-	list_init(&random_instance, alloc, sizeof(Clause), m_end, false);
-
-	List transformed_instance;
-	list_init(&transformed_instance, alloc, sizeof(Clause), m_end, false);
-
-	List in_var_pos;
-	list_init(&in_var_pos, alloc, sizeof(uint32), n, true);
-	List out_var_pos;
-	list_init(&out_var_pos, alloc, sizeof(uint32), n, true);
-	List out_var_ring;
-	list_init(&out_var_ring, alloc, sizeof(uint32), n, true);
-	List solution;
-	list_init(&solution, alloc, sizeof(bool), n, true);
-	List out_solution;
-	list_init(&out_solution, alloc, sizeof(bool), n, true);
-	Buffer tree;
-	buffer_init(&tree, 500000);
-
-	List tree_sizes;
-	list_init(&tree_sizes, alloc, sizeof(mem_index), 100, false);
-
-	List max_sizes;
-	list_init(&max_sizes, alloc, sizeof(mem_index), test_count, false);
-
-	Rand r;
-	rand_set_seed(&r, 1);
-
-	mem_index max_max_tree_size = 0;
-	mem_index min_max_tree_size = 10000000;
-	mem_index avg_max_tree_size = 0;
+void sweep_run(SweepContext* context, uint32 m_end, Allocator* alloc) {
+	bool pipeline = false;
+	for (uint32 s = 0; s < PIPELINE_STAGE_COUNT; s++) {
+		if (context->config->pipeline_threads[s] > 0) pipeline = true;
+	}
+	if (pipeline && !context->chained) {
+		sweep_run_pipeline(context, m_end, alloc);
+	}
+	else {
+		sweep_run_tasks(context, m_end, alloc);
+	}
+}
 
-	while (m1 <= m_end) {
+/*
+ Successes (instances with a solution) in the first count tests of an m.
+*/
+uint32 sweep_first_successes(SweepContext* context, uint32 m_index, uint32 count) {
+	uint32 successes = 0;
+	for (uint32 test = 0; test < count; test++) {
+		SweepTaskResult result = list_read(&context->results, m_index * context->test_count + test, SweepTaskResult);
+		if (result.solution_exists) successes++;
+	}
+	return successes;
+}
 
-		int count = test_count;
+/*
+ Sequential sampling: every m gets tests by batches of config->adaptive_batch, in rounds, until the interval of its
+ P(SAT) is narrower than config->adaptive_width. The budget is test_count tests per m: an m stops at test_count tests,
+ unless its interval still contains 0.5, and then it goes on with the tests that the settled m did not use, up to
+ context->test_count (adaptive_max_factor * test_count) tests. So the m far from the threshold settle after a few
+ batches, and their tests go to the m near P(SAT) = 0.5.
+ A round only depends on the tests of the previous ones, so after a resume the rounds already done are replayed
+ without running anything, and the tests are the same as in an uninterrupted run.
+*/
+void sweep_run_adaptive(SweepContext* context, uint32 test_count, uint32 m_end, Allocator* alloc) {
+	assert(context->config->shard_count <= 1, "adaptive sampling needs every test of an m, it cannot be sharded");
+	uint32 max_test_count = context->test_count;
+	uint32 batch = context->config->adaptive_batch < 1 ? 1 : context->config->adaptive_batch;
+	List tested; //tests scheduled for every m
+	list_init(&tested, alloc, sizeof(uint32), context->m_count, true);
+	list_set_to_zero(&tested);
+	List slots;
+	list_init(&slots, alloc, sizeof(uint32), context->m_count * batch, false);
+	context->task_slots = &slots;
 
-		uint32 non_empty_solution_count = 0;
-		uint32 no_solution_count = 0;
-		uint32 test_index = 0;
-		while (count-- > 0) {
+	while (true) {
+		//the tests left once every m that is not settled has test_count of them
+		int64 spare = (int64)context->m_count * test_count;
+		for (uint32 m_index = 0; m_index < context->m_count; m_index++) {
+			uint32 count = list_read(&tested, m_index, uint32);
+			uint32 successes = sweep_first_successes(context, m_index, count);
+			bool settled = count > 0 && proportion_interval_width(successes, count) <= context->config->adaptive_width;
+			spare -= settled || count > test_count ? count : test_count;
+		}
 
-			if (count % 10 == 0) {
-				printf("m = %d - count = %d\n", m1, count);
+		list_clear(&slots);
+		bool scheduled = false;
+		for (uint32 m_index = 0; m_index < context->m_count; m_index++) {
+			uint32 count = list_read(&tested, m_index, uint32);
+			uint32 successes = sweep_first_successes(context, m_index, count);
+			real64 low;
+			real64 high;
+			proportion_interval(successes, count, &low, &high);
+			if (count > 0 && high - low <= context->config->adaptive_width) continue;
+			uint32 batch_end = count + batch;
+			if (count < test_count) {
+				if (batch_end > test_count) batch_end = test_count;
 			}
-			list_set_to_zero(&in_var_pos);
-			list_set_to_zero(&out_var_pos);
-			list_set_to_zero(&out_var_ring);
-
-			for (uint32 i = 0; i < n; i++) {
-				list_set(&in_var_pos, i, &i);
+			else {
+				//past the budget of an m: only near the threshold, with the spare tests
+				if (!(low < 0.5 && high > 0.5) || spare <= 0) continue;
+				if (batch_end > max_test_count) batch_end = max_test_count;
+				if (batch_end - count > spare) batch_end = count + (uint32)spare;
+				if (batch_end <= count) continue;
+				spare -= batch_end - count;
 			}
+			for (uint32 test = count; test < batch_end; test++) {
+				uint32 slot = m_index * max_test_count + test;
+				SweepTaskResult result = list_read(&context->results, slot, SweepTaskResult);
+				if (!result.done) list_add(&slots, &slot);
+			}
+			list_set(&tested, m_index, &batch_end);
+			scheduled = true;
+		}
+		if (!scheduled) break;
+		if (slots.length == 0) continue; //a round done before the resume
+		context->task_count = slots.length;
+		sweep_run(context, m_end, alloc);
+	}
 
-			//list_print_uint32(&in_var_pos);
-			
-			generate_random_instance(&random_instance, n, m1, &r, alloc);
-			
-			//instance_print(&random_instance, &in_var_pos, &in_var_pos, n);
+	context->task_slots = NULL;
+	list_free(&slots);
+	list_free(&tested);
+}
 
-			uint32 total_energy = optimize_instance(&random_instance, n, &out_var_pos, &out_var_ring, &optimized_instance, 1, alloc);
-			
-			//printf("\noutVarPos:\n");
-			//list_print_uint32(&out_var_pos);
-			//printf("\noutVarRing:\n");
-			//list_print_uint32(&out_var_ring);
-			//instance_print(&optimized_instance, &out_var_pos, &out_var_ring, n);
-			
-			buffer_reset(&tree);
-			list_clear(&tree_sizes);
+/*
+ Generates and solves random 3-SAT instances for a given n variables, with m (the number of clauses) in [m_start, m_end], with increment m_inc
+ test_count instances are generated for every value of m.
+ Gor a given m, the proportion between the count of instances that have a solution vs the total instance count is stored in stats.
+ The (m, test) instances run on config->sweep_thread_count workers, or through a pipeline of stages when
+ config->pipeline_threads is set (not with nested instances, where an instance depends on the previous m).
+ Every instance has its own random stream and result slot, and the statistics are aggregated in (m, test) order
+ once all are done, so they do not depend on the worker count.
+ With config->adaptive_width, an m stops getting tests once its proportion is known well enough, and the m near the
+ threshold get the tests saved on the others.
+ With config->shard_count, only the tasks of config->shard_index run, and config->results_path gets their summary.
+ With config->checkpoint_path, the results are saved every config->checkpoint_seconds, and config->resume
+ only runs the instances missing from the checkpoint, with the same final statistics.
+*/
+void compute_transition_stats(uint32 n, uint32 m_start, uint32 m_end, uint32 m_inc, uint32 test_count, List* stats, SweepConfig* config, Allocator* alloc, bool test_sol) {
 
+	assert(m_inc > 0, "m increment should not be 0");
+	if (m_end < m_start || test_count == 0) return;
 
-			//remap the vars to their new positions, solve on this transformed instance, and then transform the solution back.
-			transform_instance(&out_var_pos, &out_var_ring, n, &optimized_instance, &transformed_instance);
-			
-			bool solution_exists = solve_tree_instance_with_tree_size(&transformed_instance, n, &tree_sizes, &tree, &solution, alloc);
-			
+	//adaptive sampling keeps room for the tests of the m near the threshold
+	bool adaptive = config->adaptive_width > 0 && !config->nested_instances;
+	uint32 max_test_count = adaptive ? test_count * (config->adaptive_max_factor < 1 ? 1 : config->adaptive_max_factor) : test_count;
+	SweepContext context;
+	sweep_context_init(&context, n, m_start, m_end, m_inc, max_test_count, config, alloc, test_sol);
 
-			if (solution_exists) {
-				if (test_sol) {
-					test_solution(&transformed_instance, &solution, n, false);
-					transform_solution(&solution, &out_solution, &out_var_ring, n);
-					test_solution(&random_instance, &out_solution, n, false);
-				}
-				non_empty_solution_count++;
-			}
-			else {
-				no_solution_count++;
+	if (adaptive) {
+		sweep_run_adaptive(&context, test_count, m_end, alloc);
+	}
+	else {
+		sweep_run(&context, m_end, alloc);
+	}
+	if (config->checkpoint_path != NULL) {
+		sweep_checkpoint_write(&context);
+	}
+
+	SweepSummary* summaries = (SweepSummary*)malloc(context.m_count * sizeof(SweepSummary));
+	for (uint32 m_index = 0; m_index < context.m_count; m_index++) {
+		SweepSummary* summary = &summaries[m_index];
+		sweep_summary_init(summary);
+		for (uint32 test = 0; test < context.test_count; test++) {
+			SweepTaskResult result = list_read(&context.results, m_index * context.test_count + test, SweepTaskResult);
+			if (!result.done) continue; //not needed by adaptive sampling, or in another shard
+			sweep_summary_add(summary, &result);
+			if (config->max_tree_sizes != NULL) {
+				list_add(config->max_tree_sizes, &result.max_tree_size);
 			}
-			
-			if (count % 10 == 0) {
-				//tree size statistics
-				mem_index max_size = 0;
-				for (uint32 i = 0; i < tree_sizes.length; i++) {
-					mem_index size = list_read(&tree_sizes, i, mem_index);
-					if (size > max_size) {
-						max_size = size;
-					}
-				}
-				//avg_max_tree_size += max_size;
-				list_add(&max_sizes, &max_size);
+		}
+		if (context.clause_histograms != NULL) {
+			summary->clause_tree_size_histogram = context.clause_histograms[m_index];
+		}
+		summary->profile = context.profiles[m_index];
 
-				if (max_max_tree_size < max_size) {
-					max_max_tree_size = max_size;
-				}
+		sweep_summary_print(summary, m_start + m_index * m_inc, config->adaptive_width > 0 || config->shard_count > 1, context.clause_histograms != NULL, config->print_histograms);
+		if (config->ordering_cache != NULL) {
+			OrderingCache* cache = config->ordering_cache;
+			printf("ordering cache hits: %u, misses: %u, not kept (cache full): %u\n", cache->hit_count, cache->miss_count, cache->full_count);
+		}
 
-				if (max_size < min_max_tree_size) {
-					min_max_tree_size = max_size;
-				}
+		real32 proportion = (real32)summary->solution_count / (real32)summary->test_count;
+		list_add(stats, &proportion);
+	}
+	if (config->results_path != NULL) {
+		sweep_results_write(&context, summaries);
+	}
+	free(summaries);
 
-				//average and ecart type
-				real32 average_max_size = 0.0f;
-				for (uint32 i = 0; i < max_sizes.length; i++) {
-					int32 v = (int32)list_read(&max_sizes, i, uint32);
-					average_max_size += v;
-				}
-				average_max_size = average_max_size / max_sizes.length;
+	sweep_context_free(&context);
+}
 
-				real32 standard_deviation = 0.0f;
-				for (uint32 i = 0; i < max_sizes.length; i++) {
-					int32 v = (int32)list_read(&max_sizes, i, uint32);
-					standard_deviation += (v - average_max_size)*(v - average_max_size);
-				}
-				standard_deviation = (real32)(standard_deviation / max_sizes.length);
-				standard_deviation = (real32)sqrt(standard_deviation);
+/*
+ Tests and successes (instances with a solution) of the first tests of an m that are done.
+*/
+uint32 sweep_successes(SweepContext* context, uint32 m_index, uint32* count) {
+	uint32 successes = 0;
+	*count = 0;
+	for (uint32 test = 0; test < context->test_count; test++) {
+		SweepTaskResult result = list_read(&context->results, m_index * context->test_count + test, SweepTaskResult);
+		if (!result.done) break;
+		(*count)++;
+		if (result.solution_exists) successes++;
+	}
+	return successes;
+}
 
-				printf("average max tree size: %lf\n", average_max_size);
-				printf("max tree size standard deviation: %lf\n", standard_deviation);
-				printf("max max tree size: %zu\n", max_max_tree_size);
-				printf("min max tree size: %zu\n", min_max_tree_size);
-			}
+/*
+ Tests an m by batches of config->adaptive_batch, until the interval of its P(SAT) is on one side of 0.5, or it has
+ test_count tests. Returns 1 if P(SAT) is above 0.5, -1 if it is below, and 0 if it cannot tell.
+*/
+int32 sweep_threshold_side(SweepContext* context, uint32 m_index, uint32 m_end, List* slots, Allocator* alloc) {
+	uint32 test_count = context->test_count;
+	uint32 batch = context->config->adaptive_batch < 1 ? 1 : context->config->adaptive_batch;
+	while (true) {
+		uint32 count;
+		uint32 successes = sweep_successes(context, m_index, &count);
+		real64 low;
+		real64 high;
+		proportion_interval(successes, count, &low, &high);
+		if (low > 0.5) return 1;
+		if (high < 0.5) return -1;
+		if (count == test_count) return 2 * successes > count ? 1 : (2 * successes < count ? -1 : 0);
+
+		uint32 batch_end = count + batch < test_count ? count + batch : test_count;
+		list_clear(slots);
+		for (uint32 test = count; test < batch_end; test++) {
+			uint32 slot = m_index * test_count + test;
+			list_add(slots, &slot);
 		}
+		context->task_slots = slots;
+		context->task_count = slots->length;
+		sweep_run(context, m_end, alloc);
+		context->task_slots = NULL;
+	}
+}
+
+struct ThresholdEstimate {
+	real64 m; //where P(SAT) = 0.5
+	real64 m_low; //95% interval of m
+	real64 m_high;
+	uint32 bracket_low; //last m of the bisection with P(SAT) >= 0.5
+	uint32 bracket_high; //first m of the bisection with P(SAT) <= 0.5
+	uint64 instance_count;
+};
 
-		//max tree size: average and standard deviation
-		real32 average_max_size = 0.0f;
-		for (uint32 i = 0; i < max_sizes.length; i++) {
-			int32 v = (int32)list_read(&max_sizes, i, uint32);
-			average_max_size += v;
+/*
+ Fits P(SAT) = 1 / (1 + exp(-(b0 + b1 (m - m_center)))) on the tests of every m (logistic regression by Newton's
+ method), and returns where it crosses 0.5 with its interval (delta method). Returns false if the fit fails.
+*/
+bool fit_threshold(SweepContext* context, real64 m_center, ThresholdEstimate* estimate) {
+	real64 b0 = 0;
+	real64 b1 = 0;
+	//Fisher information
+	real64 i00 = 0;
+	real64 i01 = 0;
+	real64 i11 = 0;
+	for (uint32 iteration = 0; iteration < 100; iteration++) {
+		real64 g0 = 0;
+		real64 g1 = 0;
+		i00 = 0;
+		i01 = 0;
+		i11 = 0;
+		for (uint32 m_index = 0; m_index < context->m_count; m_index++) {
+			uint32 count;
+			uint32 successes = sweep_successes(context, m_index, &count);
+			if (count == 0) continue;
+			real64 x = context->m_start + m_index * context->m_inc - m_center;
+			real64 p = 1 / (1 + exp(-(b0 + b1 * x)));
+			real64 residual = successes - count * p;
+			real64 w = count * p * (1 - p);
+			g0 += residual;
+			g1 += residual * x;
+			i00 += w;
+			i01 += w * x;
+			i11 += w * x * x;
 		}
-		average_max_size = average_max_size / max_sizes.length;
+		real64 det = i00 * i11 - i01 * i01;
+		if (!(det > 0)) return false;
+		real64 d0 = (i11 * g0 - i01 * g1) / det;
+		real64 d1 = (i00 * g1 - i01 * g0) / det;
+		b0 += d0;
+		b1 += d1;
+		if (fabs(d0) < 1e-10 && fabs(d1) < 1e-10) break;
+	}
+	if (!(b1 < 0)) return false;
+
+	real64 det = i00 * i11 - i01 * i01;
+	//covariance of (b0, b1)
+	real64 c00 = i11 / det;
+	real64 c01 = -i01 / det;
+	real64 c11 = i00 / det;
+	real64 d0 = -1 / b1; //gradient of m = m_center - b0 / b1
+	real64 d1 = b0 / (b1 * b1);
+	real64 sd = sqrt(d0 * d0 * c00 + 2 * d0 * d1 * c01 + d1 * d1 * c11);
+	estimate->m = m_center - b0 / b1;
+	estimate->m_low = estimate->m - 1.96 * sd;
+	estimate->m_high = estimate->m + 1.96 * sd;
+	return isfinite(estimate->m) && isfinite(sd);
+}
 
-		real32 standard_deviation = 0.0f;
-		for (uint32 i = 0; i < max_sizes.length; i++) {
-			int32 v = (int32)list_read(&max_sizes, i, uint32);
-			standard_deviation += (v-average_max_size)*(v-average_max_size);
+/*
+ Locates the m in [m_start, m_end] where P(SAT) = 0.5, without sweeping every m: bisects on m (P(SAT) decreases with
+ m), testing each m only until it is clearly on one side of 0.5 (at most test_count tests), and then fits a logistic
+ curve on all the tests. The interval of alpha_c = m / n is printed with the estimate.
+ Uses the same SweepConfig as compute_transition_stats (workers, ordering, checkpoint), but never chains instances:
+ warm_start and nested_instances are ignored.
+*/
+ThresholdEstimate find_threshold(uint32 n, uint32 m_start, uint32 m_end, uint32 test_count, SweepConfig* config, Allocator* alloc, bool test_sol) {
+	assert(m_start < m_end && test_count > 0, "the threshold needs an m range and tests");
+	assert(config->shard_count <= 1, "the threshold bisection cannot be sharded");
+	SweepConfig threshold_config = *config;
+	threshold_config.warm_start = false;
+	threshold_config.nested_instances = false;
+	config = &threshold_config;
+	SweepContext context;
+	sweep_context_init(&context, n, m_start, m_end, 1, test_count, config, alloc, test_sol);
+	List slots;
+	list_init(&slots, alloc, sizeof(uint32), config->adaptive_batch < 1 ? 1 : config->adaptive_batch, false);
+
+	uint32 low = 0;
+	uint32 high = context.m_count - 1;
+	bool bracketed = sweep_threshold_side(&context, low, m_end, &slots, alloc) >= 0 && sweep_threshold_side(&context, high, m_end, &slots, alloc) <= 0;
+	while (bracketed && high - low > 1) {
+		uint32 middle = (low + high) / 2;
+		int32 side = sweep_threshold_side(&context, middle, m_end, &slots, alloc);
+		if (side > 0) {
+			low = middle;
+		}
+		else if (side < 0) {
+			high = middle;
+		}
+		else {
+			low = middle;
+			high = middle;
 		}
-		standard_deviation = standard_deviation / max_sizes.length;
-		standard_deviation = (real32)sqrt(standard_deviation);
+	}
+	if (config->checkpoint_path != NULL) {
+		sweep_checkpoint_write(&context);
+	}
 
-		printf("average max tree size: %lf\n", average_max_size);
-		printf("max tree size standard deviation: %lf\n", standard_deviation);
-		printf("max max tree size: %zu\n", max_max_tree_size);
-		printf("min max tree size: %zu\n", min_max_tree_size);
+	ThresholdEstimate estimate;
+	estimate.bracket_low = m_start + low;
+	estimate.bracket_high = m_start + high;
+	if (!fit_threshold(&context, m_start + 0.5 * (low + high), &estimate)) {
+		//no usable fit: the bisection bracket
+		estimate.m = m_start + 0.5 * (low + high);
+		estimate.m_low = m_start + low;
+		estimate.m_high = m_start + high;
+	}
+	estimate.instance_count = 0;
+	for (uint32 m_index = 0; m_index < context.m_count; m_index++) {
+		uint32 count;
+		sweep_successes(&context, m_index, &count);
+		estimate.instance_count += count;
+	}
 
-		real32 proportion = (real32)non_empty_solution_count / (real32)(non_empty_solution_count + no_solution_count);
-		list_add(stats, &proportion);
-		m1 += m_inc;
+	if (!bracketed) {
+		printf("P(SAT) = 0.5 is not between m = %d and m = %d\n", m_start, m_end);
 	}
-	list_free(&solution);
-	list_free(&out_solution);
-	list_free(&out_var_ring);
-	list_free(&out_var_pos);
-	list_free(&in_var_pos);
-	list_free(&random_instance);
-	list_free(&transformed_instance);
-	list_free(&optimized_instance);
+	printf("threshold m: %lf [%lf, %lf]\n", estimate.m, estimate.m_low, estimate.m_high);
+	printf("threshold alpha: %lf [%lf, %lf]\n", estimate.m / n, estimate.m_low / n, estimate.m_high / n);
+	printf("threshold instances: %llu\n", (unsigned long long)estimate.instance_count);
 
-	buffer_free(&tree);
+	list_free(&slots);
+	sweep_context_free(&context);
+	return estimate;
 }
 
 /*
@@ -3369,179 +7120,204 @@ void array_to_instance(List* instance, int32 arr[], uint32 size) {
 }
 
 /*
- Transforms an instance expressed as clauses into a flat array of signed variable indices (shifted by 1 to avoid +/-0).
+ A term of the inclusion-exclusion count: the cube of the assignments that give the variables of care (bit i for
+ variable i) the values in value. The bits of value outside care are zero.
 */
-void transform_clause_to_list(Clause clause, List* c) {
-	assert(c->length == 3, "clause list should be a triplet");
-	int32 i0 = (clause.i0 + 1) * (clause.b0 ? +1 : -1);
-	int32 i1 = (clause.i1 + 1) * (clause.b1 ? +1 : -1);
-	int32 i2 = (clause.i2 + 1) * (clause.b2 ? +1 : -1);
-	list_set(c, 0, &i0);
-	list_set(c, 1, &i1);
-	list_set(c, 2, &i2);
+struct Cube {
+	uint64 care;
+	uint64 value;
+};
+
+uint32 popcount64(uint64 x) {
+#if defined(_MSC_VER)
+	return (uint32)__popcnt64(x);
+#else
+	return (uint32)__builtin_popcountll(x);
+#endif
 }
 
 /*
- Computes the intersection of two expressions (expressed as signed variable indices, shifted by 1).
+ The cube of the assignments that falsify a clause.
 */
-bool intersect(List* c1, List* c2, List* intersection, int n) {
-	list_clear(intersection);
-	if (c1->length == 0) {
-		//add c2 to intersections
-		for (uint32 i = 0; i < c2->length; i++) {
-			int32 v = list_read(c2, i, int32);
-			list_add(intersection, &v);
-		}
-		return true;
-	}
-	if (c2->length == 0) {
-		//add c1 to intersections
-		for (uint32 i = 0; i < c1->length; i++) {
-			int32 v = list_read(c1, i, int32);
-			list_add(intersection, &v);
-		}
-		return true;
-	}
-
-	int i1 = 0;
-	int i2 = 0;
-	int s1 = c1->length;
-	int s2 = c2->length;
-	int v1 = 0;
-	int v2 = 0;
-	
-	while (true) {
-		if (i1 < s1) {
-			v1 = list_read(c1,i1, int32);
-		}
-		else {
-			v1 = n + 2; //value beyond the maximum variable index (starting at 1)
-		}
-		if (i2 < s2) {
-			v2 = list_read(c2, i2, int32);
-		}
-		else {
-			v2 = n + 2; //value beyond the maximum variable index (starting at 1)
-		}
-		if ((i1 >= s1) && (i2 >= s2)) {
-			break;
-		}
-		if (abs(v1) < abs(v2)) {
-			list_add(intersection, &v1);
-			i1++;
-		}
-		else if (abs(v1) > abs(v2)) {
-			list_add(intersection, &v2);
-			i2++;
-		}
-		else if (abs(v1) == abs(v2)) {
-			//if different sign, no intersection
-			if (v1 == v2) {
-				list_add(intersection, &v1);
-				i1++;
-				i2++;
-			}
-			else {
-				return false;
-			}
-		}
+Cube clause_to_cube(Clause clause) {
+	Cube cube;
+	cube.care = (1ull << clause.i0) | (1ull << clause.i1) | (1ull << clause.i2);
+	cube.value = ((uint64)clause.b0 << clause.i0) | ((uint64)clause.b1 << clause.i1) | ((uint64)clause.b2 << clause.i2);
+	return cube;
+}
+
+/*
+ Computes the intersection of two cubes, false if they have a variable with different values.
+*/
+bool intersect(Cube c1, Cube c2, Cube* intersection) {
+	if ((c1.value ^ c2.value) & c1.care & c2.care) {
+		return false;
 	}
+	intersection->care = c1.care | c2.care;
+	intersection->value = c1.value | c2.value;
 	return true;
 }
 
+uint32 cube_volume(Cube cube, int n) {
+	return 1 << (n - popcount64(cube.care));
+}
+
+bool equal_cubes(Cube c1, Cube c2) {
+	return c1.care == c2.care && c1.value == c2.value;
+}
+
+/*
+ The terms of the inclusion-exclusion count: cubes with a signed coefficient, the covered volume being the sum of
+ coefficient * volume. Equal cubes share one term, so that opposite terms cancel out, and a term whose coefficient
+ drops to 0 is removed. The terms are kept dense in terms, and found through an open addressing index of
+ term index + 1 (0 marks an empty slot), which deletes by shifting back the slots that follow.
+*/
+struct CubeTerm {
+	Cube cube;
+	int64 coefficient;
+};
+
+struct CubeTermMap {
+	List terms;
+	List index;
+};
+
+uint32 cube_hash(Cube cube) {
+	uint64 h = cube.care * 0x9E3779B97F4A7C15ULL ^ cube.value * 0xC2B2AE3D27D4EB4FULL;
+	h ^= h >> 29;
+	return (uint32)(h ^ (h >> 32));
+}
 
-uint32 total_volume(List* elements, int n) {
-	uint32 vol = 0;
-	for (uint32 i = 0; i < elements->length; i++) {
-		List* element = d_list_read(elements, i);
-		vol += 1 << (n - element->length);
+void cube_term_map_init(CubeTermMap* map, Allocator* alloc, uint32 size) {
+	uint32 index_size = 16;
+	while (index_size < 2 * size) {
+		index_size <<= 1;
 	}
-	return vol;
+	list_init(&map->terms, alloc, sizeof(CubeTerm), size, false);
+	list_init(&map->index, alloc, sizeof(uint32), index_size, true);
+	list_set_to_zero(&map->index);
 }
 
-bool equal_clauses(List* c1, List* c2, uint32 n) {
-	
-	if (c1->length != c2->length) {
-		return false;
+void cube_term_map_free(CubeTermMap* map) {
+	list_free(&map->index);
+	list_free(&map->terms);
+}
+
+//the slot of the index holding cube, or the empty slot where it would go
+uint32 cube_term_map_slot(CubeTermMap* map, Cube cube) {
+	uint32 index_mask = map->index.length - 1;
+	uint32 slot = cube_hash(cube) & index_mask;
+	while (true) {
+		uint32 entry = list_read(&map->index, slot, uint32);
+		if (entry == 0) {
+			return slot;
+		}
+		CubeTerm term = list_read(&map->terms, entry - 1, CubeTerm);
+		if (equal_cubes(term.cube, cube)) {
+			return slot;
+		}
+		slot = (slot + 1) & index_mask;
 	}
+}
 
-	for (uint32 i = 0; i < c1->length; i++) {
-		int32 v1 = list_read(c1, i, int32);
-		int32 v2 = list_read(c2, i, int32);
-		if (v1 != v2) {
-			return false;
+void cube_term_map_remove(CubeTermMap* map, uint32 slot) {
+	uint32 index_mask = map->index.length - 1;
+	uint32 term_index = list_read(&map->index, slot, uint32) - 1;
+	//shift back the slots after it that are not at their home slot or before
+	uint32 hole = slot;
+	uint32 empty = 0;
+	for (uint32 s = (slot + 1) & index_mask; ; s = (s + 1) & index_mask) {
+		uint32 entry = list_read(&map->index, s, uint32);
+		if (entry == 0) {
+			break;
+		}
+		CubeTerm term = list_read(&map->terms, entry - 1, CubeTerm);
+		uint32 home = cube_hash(term.cube) & index_mask;
+		if (((s - home) & index_mask) >= ((s - hole) & index_mask)) {
+			list_set(&map->index, hole, &entry);
+			hole = s;
 		}
 	}
-	return true;
+	list_set(&map->index, hole, &empty);
+	//move the last term into the removed one
+	uint32 last_index = map->terms.length - 1;
+	if (term_index != last_index) {
+		CubeTerm last = list_read(&map->terms, last_index, CubeTerm);
+		uint32 last_slot = cube_term_map_slot(map, last.cube);
+		uint32 entry = term_index + 1;
+		list_set(&map->index, last_slot, &entry);
+		list_set(&map->terms, term_index, &last);
+	}
+	list_remove(&map->terms, last_index);
 }
 
-void add_element(List* d_list, List* element, int n) {
-	List* new_element = d_list_create_element_list(d_list, sizeof(int32), element->length, false);
-	for (uint32 i = 0; i < element->length; i++) {
-		int32 v = list_read(element, i, int32);
-		list_add(new_element, &v);
+//adds coefficient to the term of cube
+void cube_term_map_add(CubeTermMap* map, Cube cube, int64 coefficient) {
+	if (coefficient == 0) return;
+	if (2 * (map->terms.length + 1) > map->index.length) {
+		//grow the index and rebuild it
+		uint32 index_size = 2 * map->index.length;
+		list_free(&map->index);
+		list_init(&map->index, map->terms.alloc, sizeof(uint32), index_size, true);
+		list_set_to_zero(&map->index);
+		for (uint32 i = 0; i < map->terms.length; i++) {
+			CubeTerm term = list_read(&map->terms, i, CubeTerm);
+			uint32 entry = i + 1;
+			list_set(&map->index, cube_term_map_slot(map, term.cube), &entry);
+		}
+	}
+	uint32 slot = cube_term_map_slot(map, cube);
+	uint32 entry = list_read(&map->index, slot, uint32);
+	if (entry == 0) {
+		CubeTerm term = { cube, coefficient };
+		list_add(&map->terms, &term);
+		entry = map->terms.length;
+		list_set(&map->index, slot, &entry);
+		return;
+	}
+	CubeTerm term = list_read(&map->terms, entry - 1, CubeTerm);
+	term.coefficient += coefficient;
+	if (term.coefficient == 0) {
+		cube_term_map_remove(map, slot);
+	}
+	else {
+		list_set(&map->terms, entry - 1, &term);
 	}
 }
 
 /*
  Counts the number of solution of a given instance (exponential cost).
+ The covered volume (of the assignments that falsify a clause) is kept as cube terms; adding a clause adds its cube,
+ minus its intersection with every term.
 */
 uint32 solution_count_with_intersections(List* instance, int n, Allocator* alloc) {
+	assert(n < 32, "solution_count_with_intersections counts up to 31 variables");
 
-	List positives;
-	d_list_init(&positives, alloc, 4);
-	
-	List negatives;
-	d_list_init(&negatives, alloc, 4);
-
-	List intersections_against_positives;
-	d_list_init(&intersections_against_positives, alloc, 4);
-
-	List intersections_against_negatives;
-	d_list_init(&intersections_against_negatives, alloc, 4);
-
-	List clause;
-	list_init(&clause, alloc, sizeof(int32), 3, true);
-
-	List intersection;
-	list_init(&intersection, alloc, sizeof(int32), 3, false);
+	CubeTermMap covered;
+	cube_term_map_init(&covered, alloc, 16);
 
+	//terms to add for the current clause, collected before the map changes
+	List intersections;
+	list_init(&intersections, alloc, sizeof(CubeTerm), 16, false);
 
 	for (uint32 i = 0; i < instance->length; i++) {
 		Clause c = list_read(instance, i, Clause);
-		transform_clause_to_list(c, &clause);
-		list_clear(&intersections_against_positives);
-		list_clear(&intersections_against_negatives);
-		list_clear(&intersection);
+		Cube clause = clause_to_cube(c);
+		list_clear(&intersections);
+		int64 intersections_total_volume = 0;
 		bool drop_clause = false;
-		for (uint32 j = 0; j < positives.length; j++) {
-			List* p_clause = d_list_read(&positives, j);
-			if (intersect(&clause, p_clause, &intersection, n)) {
-				if (equal_clauses(&clause, &intersection, n)) {
-					//clause is entirely within another
-					drop_clause = true;
-					break;
-				}
-				else {
-					add_element(&intersections_against_positives, &intersection, n);
-				}
-			}
-		}
-		if (drop_clause) {
-			continue;
-		}
-		list_clear(&intersection);
-		for (uint32 j = 0; j < negatives.length; j++) {
-			List* p_clause = d_list_read(&negatives, j);
-			if (intersect(&clause, p_clause, &intersection, n)) {
-				if (equal_clauses(&clause, &intersection, n)) {
+		for (uint32 j = 0; j < covered.terms.length; j++) {
+			CubeTerm term = list_read(&covered.terms, j, CubeTerm);
+			CubeTerm intersection;
+			if (intersect(clause, term.cube, &intersection.cube)) {
+				if (equal_cubes(clause, intersection.cube)) {
 					//clause is entirely within another
 					drop_clause = true;
 					break;
 				}
-				else {
-					add_element(&intersections_against_negatives, &intersection, n);
-				}
+				intersection.coefficient = -term.coefficient;
+				intersections_total_volume += term.coefficient * cube_volume(intersection.cube, n);
+				list_add(&intersections, &intersection);
 			}
 		}
 		if (drop_clause) {
@@ -3549,38 +7325,27 @@ uint32 solution_count_with_intersections(List* instance, int n, Allocator* alloc
 		}
 
 		//check whether element does increase the current volume
-		uint32 volume_clause = 1 << (n - clause.length);
-		uint32 intersections_total_volume = 0;
-		for (uint32 i = 0; i < intersections_against_positives.length; i++) {
-			List* intersection = d_list_read(&intersections_against_positives, i);
-			intersections_total_volume += 1 << (n - intersection->length);
-		}
-		for (uint32 i = 0; i < intersections_against_negatives.length; i++) {
-			List* intersection = d_list_read(&intersections_against_negatives, i);
-			intersections_total_volume -= 1 << (n - intersection->length);
-		}
-		if (volume_clause == intersections_total_volume) {
+		if (cube_volume(clause, n) == intersections_total_volume) {
 			//element is already part of the current volume, drop it
 			continue;
 		}
 
-		//add clause to intersections against negatives so that it ends up in the positives
-		add_element(&positives, &clause, n);
-		for (uint32 i = 0; i < intersections_against_negatives.length; i++) {
-			List* element = d_list_read(&intersections_against_negatives, i);
-			add_element(&positives, element, n);
-		}
-		for (uint32 i = 0; i < intersections_against_positives.length; i++) {
-			List* element = d_list_read(&intersections_against_positives, i);
-			add_element(&negatives, element, n);
+		cube_term_map_add(&covered, clause, 1);
+		for (uint32 j = 0; j < intersections.length; j++) {
+			CubeTerm intersection = list_read(&intersections, j, CubeTerm);
+			cube_term_map_add(&covered, intersection.cube, intersection.coefficient);
 		}
 	}
 
-	uint32 positive_volume = total_volume(&positives, n);
-	uint32 negative_volume = total_volume(&negatives, n);
-	int volume = positive_volume - negative_volume;
-	int solution_count = (1 << n) - volume;
+	int64 volume = 0;
+	for (uint32 i = 0; i < covered.terms.length; i++) {
+		CubeTerm term = list_read(&covered.terms, i, CubeTerm);
+		volume += term.coefficient * cube_volume(term.cube, n);
+	}
+	uint32 solution_count = (uint32)((1ll << n) - volume);
 
+	list_free(&intersections);
+	cube_term_map_free(&covered);
 	return solution_count;
 }
 
@@ -4017,10 +7782,220 @@ bool test_optimize_1() {
 	List out_instance;
 	list_init(&out_instance, &a_0, sizeof(Clause), 10, false);
 	Rand r;
-	uint32 totalEnergy = optimize(&instance0, n1, &vars, &out_var_pos, &out_var_ring, &out_instance, &r, &a_0);
+	ClauseBlock block;
+	clause_block_init(&block, &instance0, &a_0);
+	uint32 totalEnergy = optimize(&instance0, &block, n1, &vars, &out_var_pos, &out_var_ring, &out_instance, &r, &a_0);
+	clause_block_free(&block);
 	return true;
 }
 
+void test_ring_hash() {
+	Allocator alloc;
+	allocator_init(&alloc, 10000, 1);
+	uint32 n = 6;
+	List ring;
+	list_init(&ring, &alloc, sizeof(uint32), n, true);
+	List rotated_ring;
+	list_init(&rotated_ring, &alloc, sizeof(uint32), n, true);
+	uint32 vars[] = { 3, 0, 5, 1, 4, 2 };
+	for (uint32 i = 0; i < n; i++) {
+		list_set(&ring, i, &vars[i]);
+		list_set(&rotated_ring, (i + 2) % n, &vars[i]);
+	}
+	uint64 hash = ring_hash(&ring, n);
+	assert(hash == ring_hash(&rotated_ring, n), "ring hash should not depend on rotation");
+
+	//swap across the end of the ring
+	for (uint32 left_pos = 0; left_pos < n; left_pos++) {
+		hash = ring_hash_swap(hash, &ring, n, left_pos);
+		uint32 l = list_read(&ring, left_pos, uint32);
+		uint32 r = list_read(&ring, (left_pos + 1) % n, uint32);
+		list_set(&ring, left_pos, &r);
+		list_set(&ring, (left_pos + 1) % n, &l);
+		assert(hash == ring_hash(&ring, n), "ring hash swap update");
+	}
+
+	HashSet set;
+	hash_set_init(&set, &alloc, 2);
+	for (uint64 k = 0; k < 100; k++) {
+		assert(hash_set_add(&set, k * 0x9E3779B97F4A7C15ULL), "new key");
+	}
+	assert(!hash_set_add(&set, 5 * 0x9E3779B97F4A7C15ULL), "key already in set");
+	assert(hash_set_contains(&set, 99 * 0x9E3779B97F4A7C15ULL), "");
+	assert(!hash_set_contains(&set, 100 * 0x9E3779B97F4A7C15ULL), "");
+	hash_set_clear(&set);
+	assert(!hash_set_contains(&set, 5 * 0x9E3779B97F4A7C15ULL), "");
+	hash_set_free(&set);
+	allocator_free(&alloc);
+}
+
+/*
+ clause_block_energy, with whatever kernel is built in, against clause_block_energy_scalar and the clause_energy of
+ the clauses sorted by position, on random instances and layouts (the clause counts are not all multiples of 8).
+*/
+void test_clause_block() {
+	Allocator alloc;
+	allocator_init(&alloc, 1000000, 1);
+	Rand r;
+	rand_set_seed(&r, 17);
+	List instance;
+	list_init(&instance, &alloc, sizeof(Clause), 10, false);
+	for (uint32 k = 0; k < 40; k++) {
+		uint32 n = 3 + rand_next_int(&r, 60);
+		uint32 m = rand_next_int(&r, 5 * n);
+		generate_random_instance(&instance, n, m, &r, &alloc);
+		List var_pos;
+		list_init(&var_pos, &alloc, sizeof(uint32), n, true);
+		for (uint32 i = 0; i < n; i++) {
+			list_set(&var_pos, i, &i);
+		}
+		for (uint32 i = 0; i < n; i++) {
+			uint32 p = i + rand_next_int(&r, n - i);
+			uint32 pos_p = list_read(&var_pos, p, uint32);
+			uint32 pos_i = list_read(&var_pos, i, uint32);
+			list_set(&var_pos, p, &pos_i);
+			list_set(&var_pos, i, &pos_p);
+		}
+		uint32 energy = 0;
+		for (uint32 i = 0; i < instance.length; i++) {
+			Clause clause = list_read(&instance, i, Clause);
+			energy += clause_energy(triplet_sorted_by_pos(clause, &var_pos), &var_pos, n);
+			assert(clause_span_energy(clause, &var_pos) == clause_energy(triplet_sorted_by_pos(clause, &var_pos), &var_pos, n), "clause span energy");
+		}
+		ClauseBlock block;
+		clause_block_init(&block, &instance, &alloc);
+		assert(clause_block_energy_scalar(&block, &var_pos) == energy, "scalar clause block energy");
+		assert(clause_block_energy(&block, &var_pos) == energy, "clause block energy");
+		clause_block_free(&block);
+		list_free(&var_pos);
+	}
+	list_free(&instance);
+	allocator_free(&alloc);
+}
+
+void test_var_ordering() {
+	Allocator alloc;
+	allocator_init(&alloc, 100000, 1);
+	//a chain of clauses over scrambled var labels: (l0 l1 l2) (l1 l2 l3) ...
+	uint32 n = 10;
+	uint32 labels[] = { 7, 2, 9, 0, 5, 3, 8, 1, 6, 4 };
+	List instance;
+	list_init(&instance, &alloc, sizeof(Clause), n, false);
+	for (uint32 i = 0; i + 2 < n; i++) {
+		Clause c = { labels[i], labels[i + 1], labels[i + 2], true, false, true };
+		list_add(&instance, &c);
+	}
+	List var_pos;
+	list_init(&var_pos, &alloc, sizeof(uint32), n, true);
+	List var_ring;
+	list_init(&var_ring, &alloc, sizeof(uint32), n, true);
+	List ordered_instance;
+	list_init(&ordered_instance, &alloc, sizeof(Clause), n, false);
+	OrderingMethod methods[] = { ORDERING_RCM, ORDERING_SPECTRAL, ORDERING_MULTILEVEL };
+	for (uint32 k = 0; k < 3; k++) {
+		order_instance(&instance, n, methods[k], false, &var_pos, &var_ring, &ordered_instance, 1, &alloc);
+		assert(ordered_instance.length == instance.length, "ordering keeps every clause");
+		for (uint32 i = 0; i < ordered_instance.length; i++) {
+			Clause c = list_read(&ordered_instance, i, Clause);
+			uint32 p0 = list_read(&var_pos, c.i0, uint32);
+			uint32 p2 = list_read(&var_pos, c.i2, uint32);
+			assert(p2 - p0 == 2, "chain clauses should span 3 consecutive positions");
+		}
+	}
+
+	//the Fiedler vector of a longer chain, from a random start, is monotone along the chain
+	uint32 chain_n = 40;
+	List chain_labels;
+	list_init(&chain_labels, &alloc, sizeof(uint32), chain_n, true);
+	for (uint32 i = 0; i < chain_n; i++) list_set(&chain_labels, i, &i);
+	Rand r;
+	rand_set_seed(&r, 5);
+	for (uint32 i = chain_n - 1; i > 0; i--) {
+		uint32 j = generate_int(i + 1, &r);
+		uint32 a = list_read(&chain_labels, i, uint32);
+		uint32 b = list_read(&chain_labels, j, uint32);
+		list_set(&chain_labels, i, &b);
+		list_set(&chain_labels, j, &a);
+	}
+	List chain;
+	list_init(&chain, &alloc, sizeof(Clause), chain_n, false);
+	for (uint32 i = 0; i + 2 < chain_n; i++) {
+		Clause c = { list_read(&chain_labels, i, uint32), list_read(&chain_labels, i + 1, uint32), list_read(&chain_labels, i + 2, uint32), true, false, true };
+		list_add(&chain, &c);
+	}
+	VarGraph g;
+	var_graph_init(&g, &chain, chain_n, &alloc);
+	List x;
+	list_init(&x, &alloc, sizeof(real64), chain_n, true);
+	for (uint32 v = 0; v < chain_n; v++) {
+		real64 xv = rand_next_real64(&r);
+		list_set(&x, v, &xv);
+	}
+	real64 residual = fiedler_vector(&g, &x, &alloc);
+	assert(residual <= SPECTRAL_TOLERANCE * 12, "fiedler vector should converge on a chain"); //c = 2 * 6, twice the degree of a middle var
+	List order;
+	list_init(&order, &alloc, sizeof(uint32), chain_n, true);
+	for (uint32 v = 0; v < chain_n; v++) list_set(&order, v, &v);
+	sort_indices(&order, &x, &alloc);
+	bool forward = list_read(&order, 0, uint32) == list_read(&chain_labels, 0, uint32);
+	for (uint32 i = 0; i < chain_n; i++) {
+		uint32 label = list_read(&chain_labels, forward ? i : chain_n - 1 - i, uint32);
+		assert(list_read(&order, i, uint32) == label, "fiedler order of a chain is the chain order");
+	}
+
+	//multilevel coarsens a chain this long before ordering it, and still keeps every clause within 3 positions
+	List chain_var_pos;
+	list_init(&chain_var_pos, &alloc, sizeof(uint32), chain_n, true);
+	List chain_var_ring;
+	list_init(&chain_var_ring, &alloc, sizeof(uint32), chain_n, true);
+	List ordered_chain;
+	list_init(&ordered_chain, &alloc, sizeof(Clause), chain_n, false);
+	order_instance(&chain, chain_n, ORDERING_MULTILEVEL, false, &chain_var_pos, &chain_var_ring, &ordered_chain, 1, &alloc);
+	for (uint32 i = 0; i < chain_n; i++) {
+		uint32 var = list_read(&chain_var_ring, i, uint32);
+		assert(var < chain_n && list_read(&chain_var_pos, var, uint32) == i, "multilevel ordering should be a permutation");
+	}
+	assert(ordered_chain.length == chain.length, "multilevel ordering keeps every clause");
+	for (uint32 i = 0; i < ordered_chain.length; i++) {
+		Clause c = list_read(&ordered_chain, i, Clause);
+		uint32 p0 = list_read(&chain_var_pos, c.i0, uint32);
+		uint32 p2 = list_read(&chain_var_pos, c.i2, uint32);
+		assert(p0 < p2 && p2 - p0 <= 2, "multilevel chain clauses should span at most 3 positions");
+	}
+	list_free(&ordered_chain);
+	list_free(&chain_var_ring);
+	list_free(&chain_var_pos);
+	list_free(&order);
+	list_free(&x);
+	var_graph_free(&g);
+	list_free(&chain);
+	list_free(&chain_labels);
+	allocator_free(&alloc);
+}
+
+void test_log_histogram() {
+	//every value falls in the bucket whose range it is in, and the buckets follow each other
+	for (uint32 b = 0; b + 1 < LOG_HISTOGRAM_BUCKET_COUNT; b++) {
+		assert(log_histogram_bucket(log_histogram_bucket_low(b)) == b, "bucket low value");
+		assert(log_histogram_bucket(log_histogram_bucket_high(b)) == b, "bucket high value");
+		assert(log_histogram_bucket_high(b) + 1 == log_histogram_bucket_low(b + 1), "consecutive buckets");
+	}
+	LogHistogram a;
+	LogHistogram b;
+	log_histogram_init(&a);
+	log_histogram_init(&b);
+	for (uint64 v = 1; v <= 1000; v++) {
+		log_histogram_add(v % 2 == 0 ? &a : &b, v);
+	}
+	log_histogram_merge(&a, &b);
+	assert(a.total == 1000 && a.max == 1000, "merged histogram");
+	uint64 p50 = log_histogram_percentile(&a, 50);
+	uint64 p99 = log_histogram_percentile(&a, 99);
+	assert(p50 >= 500 && p50 <= 500 + 500 / LOG_HISTOGRAM_SUB_COUNT, "p50 within a bucket");
+	assert(p99 >= 990 && p99 <= 1000, "p99 within a bucket");
+	assert(log_histogram_percentile(&a, 100) == 1000, "p100 is the max");
+}
+
 void test_add_clause() {
 	
 	Buffer b1;
@@ -4568,7 +8543,11 @@ void test_transition_stats() {
 
 	Allocator a1;
 	allocator_init(&a1, 2000000, 2);
-	compute_transition_stats(n, m1, m2, 2, 10000, &stats, &a1, false);
+	SweepConfig config;
+	sweep_config_init(&config);
+	//a fixed worker count, so that the test runs the same way on every machine
+	config.sweep_thread_count = 4;
+	compute_transition_stats(n, m1, m2, 2, 10000, &stats, &config, &a1, false);
 
 	list_print_real32(&stats);
 
@@ -4576,6 +8555,164 @@ void test_transition_stats() {
 	allocator_free(&a0);
 }
 
+/*
+ A sweep stopped part-way and resumed from its checkpoint gives the same statistics and tree sizes as a full run.
+*/
+void test_sweep_checkpoint() {
+	Allocator alloc;
+	allocator_init(&alloc, 2000000, 2);
+	uint32 n = 12;
+	uint32 m_start = 36;
+	uint32 m_end = 60;
+	uint32 m_inc = 6;
+	uint32 test_count = 8;
+	char path[] = "three_sat_test_checkpoint.bin";
+	remove(path);
+
+	SweepConfig config;
+	sweep_config_init(&config);
+	config.sweep_thread_count = 2;
+	config.optimize_budget.max_restarts = 10;
+	List stats;
+	list_init(&stats, &alloc, sizeof(real32), 10, false);
+	List max_tree_sizes;
+	list_init(&max_tree_sizes, &alloc, sizeof(mem_index), 64, false);
+	config.max_tree_sizes = &max_tree_sizes;
+	compute_transition_stats(n, m_start, m_end, m_inc, test_count, &stats, &config, &alloc, true);
+
+	//run every other instance, and save them as if the sweep had stopped there
+	config.checkpoint_path = path;
+	SweepContext context;
+	sweep_context_init(&context, n, m_start, m_end, m_inc, test_count, &config, &alloc, true);
+	List slots;
+	list_init(&slots, &alloc, sizeof(uint32), context.m_count * test_count, false);
+	for (uint32 slot = 0; slot < context.m_count * test_count; slot += 2) {
+		list_add(&slots, &slot);
+	}
+	context.task_slots = &slots;
+	context.task_count = slots.length;
+	sweep_run(&context, m_end, &alloc);
+	sweep_checkpoint_write(&context);
+	context.task_slots = NULL;
+	sweep_context_free(&context);
+
+	//the checkpoint has the instances that ran, with their results
+	config.resume = true;
+	sweep_context_init(&context, n, m_start, m_end, m_inc, test_count, &config, &alloc, true);
+	uint32 done_count = 0;
+	for (uint32 slot = 0; slot < context.results.length; slot++) {
+		SweepTaskResult result = list_read(&context.results, slot, SweepTaskResult);
+		if (!result.done) continue;
+		done_count++;
+		assert(slot % 2 == 0 && result.max_tree_size == list_read(&max_tree_sizes, slot, mem_index), "checkpoint result");
+	}
+	assert(done_count == slots.length, "checkpoint results");
+	sweep_context_free(&context);
+	list_free(&slots);
+
+	List resumed_stats;
+	list_init(&resumed_stats, &alloc, sizeof(real32), 10, false);
+	List resumed_max_tree_sizes;
+	list_init(&resumed_max_tree_sizes, &alloc, sizeof(mem_index), 64, false);
+	config.max_tree_sizes = &resumed_max_tree_sizes;
+	compute_transition_stats(n, m_start, m_end, m_inc, test_count, &resumed_stats, &config, &alloc, true);
+
+	assert(stats.length == resumed_stats.length && max_tree_sizes.length == resumed_max_tree_sizes.length, "resumed sweep size");
+	for (uint32 i = 0; i < stats.length; i++) {
+		assert(list_read(&stats, i, real32) == list_read(&resumed_stats, i, real32), "resumed sweep statistics");
+	}
+	for (uint32 i = 0; i < max_tree_sizes.length; i++) {
+		assert(list_read(&max_tree_sizes, i, mem_index) == list_read(&resumed_max_tree_sizes, i, mem_index), "resumed sweep tree sizes");
+	}
+	remove(path);
+	allocator_free(&alloc);
+}
+
+/*
+ The results files of the shards of a sweep, merged, give the statistics of the whole sweep.
+*/
+void test_sweep_shards() {
+	Allocator alloc;
+	allocator_init(&alloc, 2000000, 2);
+	uint32 n = 12;
+	uint32 m_start = 36;
+	uint32 m_end = 60;
+	uint32 m_inc = 6;
+	uint32 test_count = 9;
+	char path0[] = "three_sat_test_shard0.bin";
+	char path1[] = "three_sat_test_shard1.bin";
+
+	SweepConfig config;
+	sweep_config_init(&config);
+	config.optimize_budget.max_restarts = 10;
+	List stats;
+	list_init(&stats, &alloc, sizeof(real32), 10, false);
+	compute_transition_stats(n, m_start, m_end, m_inc, test_count, &stats, &config, &alloc, false);
+
+	List shard_stats;
+	list_init(&shard_stats, &alloc, sizeof(real32), 10, false);
+	config.shard_count = 2;
+	char* paths[2] = { path0, path1 };
+	for (uint32 shard = 0; shard < 2; shard++) {
+		config.shard_index = shard;
+		config.results_path = paths[shard];
+		compute_transition_stats(n, m_start, m_end, m_inc, test_count, &shard_stats, &config, &alloc, false);
+	}
+	List merged_stats;
+	list_init(&merged_stats, &alloc, sizeof(real32), 10, false);
+	merge_sweep_results(paths, 2, &merged_stats, false);
+	assert(stats.length == merged_stats.length, "merged sweep size");
+	for (uint32 i = 0; i < stats.length; i++) {
+		assert(list_read(&stats, i, real32) == list_read(&merged_stats, i, real32), "merged sweep statistics");
+	}
+	remove(path0);
+	remove(path1);
+	allocator_free(&alloc);
+}
+
+/*
+ find_threshold on a small n: P(SAT), measured again on other instances, is above 0.5 at the low end of the bisection
+ bracket and below it at the high end, and the fitted m is around the bracket.
+*/
+void test_find_threshold() {
+	Allocator alloc;
+	allocator_init(&alloc, 2000000, 2);
+	uint32 n = 10;
+	SweepConfig config;
+	sweep_config_init(&config);
+	config.sweep_thread_count = 2;
+	config.ordering = ORDERING_RCM; //cheaper, and P(SAT) does not depend on the ordering
+	ThresholdEstimate estimate = find_threshold(n, 20, 80, 100, &config, &alloc, false);
+	assert(estimate.bracket_high - estimate.bracket_low <= 1, "threshold bisection bracket");
+	assert(estimate.m >= estimate.bracket_low - 1.0 && estimate.m <= estimate.bracket_high + 1.0, "threshold fit outside the bracket");
+
+	List stats;
+	list_init(&stats, &alloc, sizeof(real32), 2, false);
+	uint32 m_inc = estimate.bracket_high > estimate.bracket_low ? estimate.bracket_high - estimate.bracket_low : 1;
+	compute_transition_stats(n, estimate.bracket_low, estimate.bracket_high, m_inc, 200, &stats, &config, &alloc, false);
+	list_print_real32(&stats);
+	assert(list_read(&stats, 0, real32) >= 0.45f, "P(SAT) below 0.5 at the low end of the threshold bracket");
+	assert(list_read(&stats, stats.length - 1, real32) <= 0.55f, "P(SAT) above 0.5 at the high end of the threshold bracket");
+	list_free(&stats);
+	allocator_free(&alloc);
+}
+
+/*
+ Solution count of an instance, by trying every assignment of its n vars.
+*/
+uint32 brute_force_solution_count(List* instance, uint32 n) {
+	uint32 count = 0;
+	for (uint32 bits = 0; bits < (1u << n); bits++) {
+		bool satisfied = true;
+		for (uint32 i = 0; satisfied && i < instance->length; i++) {
+			Clause c = list_read(instance, i, Clause);
+			satisfied = clause_is_satisfied(&c, (bits >> c.i0) & 1, (bits >> c.i1) & 1, (bits >> c.i2) & 1);
+		}
+		if (satisfied) count++;
+	}
+	return count;
+}
+
 void test_solution_count_with_intersections() {
 	Allocator a_0;
 	allocator_init(&a_0, 20000000, 1);
@@ -4593,18 +8730,89 @@ void test_solution_count_with_intersections() {
 	uint32 sol_count_1 = count_tree_solutions(&tree, n, &a_0);
 	uint32 sol_count_2 = solution_count_with_intersections(&instance0, n, &a_0);
 	assert(sol_count_1 == sol_count_2, "");
+	assert(sol_count_2 == brute_force_solution_count(&instance0, n), "solution count against brute force");
+	list_free(&solution);
+
+	//random instances from a few clauses to past the threshold, where most have no solution
+	Rand r;
+	rand_set_seed(&r, 5);
+	for (n = 5; n <= 14; n++) {
+		for (uint32 k = 0; k < 8; k++) {
+			uint32 m = 1 + rand_next_int(&r, 6 * n);
+			generate_random_instance(&instance0, n, m, &r, &a_0);
+			uint32 count = brute_force_solution_count(&instance0, n);
+			assert(solution_count_with_intersections(&instance0, n, &a_0) == count, "solution count with intersections against brute force");
+		}
+	}
+	buffer_free(&tree);
+	list_free(&instance0);
+	allocator_free(&a_0);
 }
 
 int main(int ArgCount, char **Args)
 {
+	//three_sat threshold <n> <m start> <m end> <tests>: locates the m where P(SAT) = 0.5
+	if (ArgCount > 5 && strcmp(Args[1], "threshold") == 0) {
+		Allocator alloc;
+		allocator_init(&alloc, 2000000, 2);
+		SweepConfig config;
+		sweep_config_init(&config);
+		config.sweep_thread_count = std::thread::hardware_concurrency();
+		find_threshold(atoi(Args[2]), atoi(Args[3]), atoi(Args[4]), atoi(Args[5]), &config, &alloc, false);
+		allocator_free(&alloc);
+		return 0;
+	}
+
+	//three_sat shard <index> <count> <results file> <n> <m start> <m end> <m inc> <tests> [checkpoint file]:
+	//runs shard index of count of a sweep, and writes its summary to the results file for merge
+	if (ArgCount > 9 && strcmp(Args[1], "shard") == 0) {
+		Allocator alloc;
+		allocator_init(&alloc, 2000000, 2);
+		SweepConfig config;
+		sweep_config_init(&config);
+		config.sweep_thread_count = std::thread::hardware_concurrency();
+		config.shard_index = atoi(Args[2]);
+		config.shard_count = atoi(Args[3]);
+		assert(config.shard_index < config.shard_count, "the shard index should be below the shard count");
+		config.results_path = Args[4];
+		if (ArgCount > 10) {
+			config.checkpoint_path = Args[10];
+			config.resume = true;
+		}
+		List stats;
+		list_init(&stats, &alloc, sizeof(real32), 10, false);
+		compute_transition_stats(atoi(Args[5]), atoi(Args[6]), atoi(Args[7]), atoi(Args[8]), atoi(Args[9]), &stats, &config, &alloc, false);
+		allocator_free(&alloc);
+		return 0;
+	}
+
+	//three_sat merge <results file>...: combines the results of the shards of a sweep
+	if (ArgCount > 2 && strcmp(Args[1], "merge") == 0) {
+		Allocator alloc;
+		allocator_init(&alloc, 100000, 2);
+		List stats;
+		list_init(&stats, &alloc, sizeof(real32), 10, false);
+		merge_sweep_results(Args + 2, ArgCount - 2, &stats, false);
+		list_print_real32(&stats);
+		allocator_free(&alloc);
+		return 0;
+	}
+
 	test_buffer();
 	clause_test();
 	test_rand();
+	test_ring_hash();
+	test_clause_block();
+	test_var_ordering();
+	test_log_histogram();
 	//test_transition_model();
 	test_add_clause();
 
 	//test_optimize_1();
-	//test_solution_count_with_intersections();
+	test_solution_count_with_intersections();
+	test_sweep_checkpoint();
+	test_sweep_shards();
+	test_find_threshold();
 	test_transition_stats();
 	
 }